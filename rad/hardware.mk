@@ -29,6 +29,8 @@ include $(RAD)/machines/generic/machine.mk
 include rad_storage_fatfs.mk
 # -- Win32 Emulation
 # include rad_storage_Win32.mk
+# -- POSIX host (Linux, macOS)
+# include rad_storage_posix.mk
 # -- Dummy (Disable Storage)
 # include rad_storage_dummy.mk
 
@@ -0,0 +1,2 @@
+RADSRC += $(RAD)/storage/posix/storage_lld.c
+RADINC += $(RAD)/storage/posix
@@ -67,6 +67,129 @@ static void printer_wait_temperature(void)
   }
 }
 
+static void dispatch_dwell(void)
+{
+  printer_wait_motion();
+  chThdSleepMilliseconds(curr_command->p_value);
+}
+
+static void dispatch_homing(void)
+{
+  printer_wait_motion();
+  commandHoming();
+}
+
+static void dispatch_set_position(void)
+{
+  commandSetPosition();
+}
+
+static void dispatch_set_tool_temp(void)
+{
+  if (curr_command->p_value < 0)
+  {
+    target_tool_id = mode.tool;
+  } else {
+    target_tool_id = curr_command->p_value;
+  }
+  if (target_tool_id >= 0 && target_tool_id < RAD_NUMBER_EXTRUDERS) {
+    printer_wait_motion();
+    temperatureSet(machine.extruder.devices[target_tool_id].temp_id, curr_command->s_value);
+  } else {
+    target_tool_id = -1;
+  }
+}
+
+static void dispatch_set_bed_temp(void)
+{
+  if (curr_command->p_value < 0)
+  {
+    target_tool_id = mode.tool;
+  } else {
+    target_tool_id = curr_command->p_value;
+  }
+  if (target_tool_id >= 0 && target_tool_id < machine.heated_bed.count) {
+    printer_wait_motion();
+    temperatureSet(machine.heated_bed.devices[target_tool_id].temp_id, curr_command->s_value);
+  } else {
+    target_tool_id = -1;
+  }
+}
+
+static void dispatch_fan_speed(void)
+{
+  int8_t pwm_id = -1;
+  if (curr_command->p_value < 0)
+  {
+    if (mode.tool >= 0 && mode.tool < RAD_NUMBER_EXTRUDERS)
+      pwm_id = machine.temperature.devices[machine.extruder.devices[mode.tool].temp_id].cooling_pwm_id;
+  } else if (curr_command->p_value < machine.fan.count)
+  {
+    pwm_id = machine.fan.devices[curr_command->p_value].pwm_id;
+  }
+  if (pwm_id >= 0)
+    outputSet(pwm_id, curr_command->s_value);
+}
+
+/*
+ * M73 P<percent> R<minutes>, written by slicers and tools/gcodetime.
+ * Only the time left is kept, progress comes from the file position.
+ */
+static void dispatch_print_progress(void)
+{
+  if (!isnan(curr_command->r_value) && curr_command->r_value >= 0)
+    printerTimeSetLeft(curr_command->r_value * 60);
+}
+
+/*
+ * M303 P<temperature> S<target> R<cycles>, P defaults to the current
+ * tool and R to 5. The tune runs in the background, progress is in the
+ * host telemetry and the gains can be kept with M500.
+ */
+static void dispatch_autotune(void)
+{
+  int8_t temp_id;
+  if (curr_command->p_value >= 0)
+  {
+    if (curr_command->p_value >= RAD_NUMBER_TEMPERATURES)
+    {
+      printerSetMessage(L_TEMPERATURE_AUTOTUNE_REFUSED);
+      return;
+    }
+    temp_id = curr_command->p_value;
+  }
+  else if (mode.tool >= 0 && mode.tool < RAD_NUMBER_EXTRUDERS)
+    temp_id = machine.extruder.devices[mode.tool].temp_id;
+  else
+  {
+    printerSetMessage(L_TEMPERATURE_AUTOTUNE_REFUSED);
+    return;
+  }
+  uint8_t cycles = 5;
+  if (!isnan(curr_command->r_value) && curr_command->r_value >= 1)
+    cycles = fmin(curr_command->r_value, 255);
+  printer_wait_motion();
+  if (!temperatureAutoTune(temp_id, curr_command->s_value, cycles))
+    printerSetMessage(L_TEMPERATURE_AUTOTUNE_REFUSED);
+}
+
+static void dispatch_feedrate_multiplier(void)
+{
+  printerSetFeedrateMultiplier(curr_command->s_value / 100.0f);
+}
+
+static void dispatch_flow_multiplier(void)
+{
+  printerSetFlowMultiplier(curr_command->s_value / 100.0f);
+}
+
+#define DISPATCH_ENTRY(id, letter, number, type, params, decode, dispatch) \
+  [GCODE_##id] = dispatch,
+
+static void (* const dispatch_handlers[GCODE_Count])(void) = {
+  GCODE_TABLE(DISPATCH_ENTRY)
+};
+
 static void printer_dispatch(void)
 {
   if (printerIsEstopped())
@@ -89,43 +212,12 @@ static void printer_dispatch(void)
   if (curr_command->printer.unit)
     mode.unit = curr_command->printer.unit;
 
-  if (!printerIsEstopped())
+  // M109/M190 come as M104/M140 with a wait, set the target they wait for
+  void (*handler)(void) = dispatch_handlers[curr_command->code];
+  if (curr_command->code == GCODE_M104 || curr_command->code == GCODE_M140)
   {
-    switch (curr_command->code)
-    {
-      case 10104: // Set current tool temp
-      case 10109: // Set current tool temp and wait
-        if (curr_command->p_value < 0)
-        {
-          target_tool_id = mode.tool;
-        } else if (curr_command->p_value >= 0 || curr_command->p_value < RAD_NUMBER_EXTRUDERS)
-        {
-          target_tool_id = curr_command->p_value;
-        }
-        if (target_tool_id >= 0 && target_tool_id < RAD_NUMBER_EXTRUDERS) {
-          printer_wait_motion();
-          temperatureSet(machine.extruder.devices[target_tool_id].temp_id, curr_command->s_value);
-        } else {
-          target_tool_id = -1;
-        }
-        break;
-      case 10140: // Set bed temp
-      case 10190: // Set bed temp and wait
-        if (curr_command->p_value < 0)
-        {
-          target_tool_id = mode.tool;
-        } else if (curr_command->p_value >= 0 || curr_command->p_value < RAD_NUMBER_EXTRUDERS)
-        {
-          target_tool_id = curr_command->p_value;
-        }
-        if (target_tool_id >= 0 && target_tool_id < machine.heated_bed.count) {
-          printer_wait_motion();
-          temperatureSet(machine.heated_bed.devices[target_tool_id].temp_id, curr_command->s_value);
-        } else {
-          target_tool_id = -1;
-        }
-        break;
-    }
+    handler();
+    handler = NULL;
   }
 
   // Wait Temp
@@ -137,40 +229,8 @@ static void printer_dispatch(void)
     printerSetMessage(NULL);
   }
 
-  int8_t pwm_id;
-  switch (curr_command->code)
-  {
-    case 4:
-      printer_wait_motion();
-      chThdSleepMilliseconds(curr_command->p_value);
-      break;
-    case 28:
-      printer_wait_motion();
-      commandHoming();
-      break;
-    case 92:
-      commandSetPosition();
-      break;
-    case 10106: // Fan speed
-      pwm_id = -1;
-      if (isnan(curr_command->p_value))
-      {
-        if (mode.tool >= 0 && mode.tool < RAD_NUMBER_EXTRUDERS)
-          pwm_id = machine.temperature.devices[machine.extruder.devices[mode.tool].temp_id].cooling_pwm_id;
-      } else if (curr_command->p_value >= 0 || curr_command->p_value < machine.fan.count)
-      {
-        pwm_id = machine.fan.devices[curr_command->p_value].pwm_id;
-      }
-      if (pwm_id >= 0)
-        outputSet(pwm_id, curr_command->s_value);
-      break;
-    case 10220: // Set feedrate multiplier (speed factor override)
-      printerSetFeedrateMultiplier(curr_command->s_value / 100.0f);
-      break;
-    case 10221: // Set flow multiplier (extrude factor override)
-      printerSetFlowMultiplier(curr_command->s_value / 100.0f);
-      break;
-  }
+  if (handler)
+    handler();
 
   // Motion
   if (!(curr_command->type & COMMANDTYPE_CanHaveAxisWords) ||
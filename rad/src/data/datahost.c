@@ -19,15 +19,41 @@
 
 #include "ch.h"
 #include "chprintf.h"
+#include "memstreams.h"
 #include "rad.h"
+#include <stdlib.h>
+#include <stdarg.h>
 
 #define COMMAND_LENGTH 128
-#define hostprintf(c, ...) \
-  RAD_DEBUG_PRINTF(__VA_ARGS__); \
-  chprintf((BaseSequentialStream*)((c)->channel), __VA_ARGS__);
+#define READ_BLOCK_SIZE 64
+#define OUTPUT_BUFFER_SIZE 256
 
 #define REPORT_INTERVAL (S2ST(0.2))
 #define IDLE_INTERVAL (MS2ST(500))
+#define POLL_INTERVAL (MS2ST(200))
+
+typedef enum {
+  UPLOAD_None = 0,
+  UPLOAD_Text = 1,
+  UPLOAD_Binary = 2
+} HostUploadMode;
+
+typedef struct {
+  HostUploadMode mode;
+  uint32_t size;
+  systime_t last_time;
+  /* Text mode: bytes waiting in data for a full sector */
+  uint16_t fill;
+  /* Text mode: checksum of the line as received, up to the '*' */
+  uint8_t checksum;
+  bool_t checksum_end;
+  /* Binary mode: next block expected and bytes of the current one so far */
+  uint16_t sequence;
+  uint16_t got;
+  uint8_t header[HOST_UPLOAD_HEADER_SIZE];
+  uint8_t crc[4];
+  uint8_t data[HOST_UPLOAD_BLOCK_SIZE];
+} HostUpload;
 
 typedef struct {
   BaseAsynchronousChannel* channel;
@@ -39,6 +65,8 @@ typedef struct {
 
   char* ptr;
   char buf[COMMAND_LENGTH];
+  char rx[READ_BLOCK_SIZE];
+  bool_t overflow;
   decode_context_t decode_context;
   parse_context_t parse_context;
   PrinterCommand command;
@@ -47,20 +75,493 @@ typedef struct {
   uint8_t busy;
 
   int32_t last_received_line;
+
+  systime_t telemetry_interval;
+  systime_t last_telemetry_time;
+  uint16_t telemetry_sequence;
+
+  HostUpload upload;
+
+  MemoryStream out;
+  uint8_t out_buffer[OUTPUT_BUFFER_SIZE + 1];
 } HostContext;
 
-static WORKING_AREA(waDataHost, 256 + sizeof(HostContext));
+#define DATA_HOST_STACK_SIZE (256 + sizeof(HostContext) + HOST_TELEMETRY_FRAME_SIZE + \
+                              HOST_HISTORY_MAX_ENTRIES * sizeof(int16_t))
+
+static WORKING_AREA(waDataHost, DATA_HOST_STACK_SIZE);
+
+static volatile bool_t debug_mirror = TRUE;
+
+static void host_flush(HostContext* c)
+{
+  if (c->out.eos == 0)
+    return;
+  // Keep the telemetry sync byte out of the text
+  if (c->telemetry_interval > 0)
+  {
+    for (size_t i = 0; i < c->out.eos; i++)
+      if (c->out_buffer[i] >= 0x80)
+        c->out_buffer[i] = '?';
+  }
+  if (debug_mirror)
+  {
+    c->out_buffer[c->out.eos] = '\0';
+    RAD_DEBUG_PRINTF("%s", c->out_buffer);
+  }
+  chnWrite(c->channel, c->out_buffer, c->out.eos);
+  c->out.eos = 0;
+}
+
+/*
+ * Output is formatted into the per-connection buffer and
+ * written out to the channel in one go by host_flush(). A message that
+ * does not fit is formatted again after what was before it is flushed,
+ * as the stream drops whatever goes past its end.
+ */
+static void hostprintf(HostContext* c, const char* fmt, ...)
+{
+  va_list ap;
+  size_t mark = c->out.eos;
+
+  va_start(ap, fmt);
+  chvprintf((BaseSequentialStream*) &c->out, fmt, ap);
+  va_end(ap);
+  if (c->out.eos < OUTPUT_BUFFER_SIZE || mark == 0)
+    return;
+
+  c->out.eos = mark;
+  host_flush(c);
+  va_start(ap, fmt);
+  chvprintf((BaseSequentialStream*) &c->out, fmt, ap);
+  va_end(ap);
+}
+
+static uint8_t* put_u16(uint8_t* p, uint16_t v)
+{
+  *p++ = v;
+  *p++ = v >> 8;
+  return p;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t v)
+{
+  p = put_u16(p, v);
+  return put_u16(p, v >> 16);
+}
+
+static uint16_t get_u16(const uint8_t* p)
+{
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t* p)
+{
+  return get_u16(p) | ((uint32_t) get_u16(p + 2) << 16);
+}
+
+static void send_telemetry(HostContext* c)
+{
+  uint8_t frame[HOST_TELEMETRY_FRAME_SIZE];
+  uint8_t* p = frame;
+
+  *p++ = HOST_TELEMETRY_SYNC;
+  *p++ = HOST_TELEMETRY_PAYLOAD_SIZE;
+  p = put_u16(p, c->telemetry_sequence++);
+  p = put_u32(p, chTimeNow());
+  for (uint8_t i = 0; i < RAD_NUMBER_TEMPERATURES; i++)
+  {
+    RadTempState s = temperatureGet(i);
+    p = put_u16(p, (int16_t) (s.pv * 10));
+    p = put_u16(p, (int16_t) (s.sv * 10));
+    *p++ = outputGet(machine.temperature.devices[i].heating_pwm_id);
+    *p++ = temperatureGetAutoTune(i);
+  }
+  RadJointsState joints = stepperGetJointsState();
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++)
+  {
+    p = put_u32(p, (int32_t) (joints.joints[i].pos * 1000));
+  }
+  *p++ = plannerMainQueueGetLength();
+  p = put_u16(p, (uint16_t) (stepperGetCurrentSpeed() * 10));
+
+  uint8_t checksum = 0;
+  for (uint8_t* q = frame + 2; q < p; q++)
+    checksum ^= *q;
+  *p++ = checksum;
+
+  // Binary frames bypass the text buffer so they never reach the debug mirror
+  host_flush(c);
+  chnWrite(c->channel, frame, p - frame);
+}
+
+/*
+ * Replies to a command with its code word, e.g. "ok #12 [G1] {-}". A line
+ * without a code word keeps the numeric form "[0]".
+ */
+static void host_reply(HostContext* c, const char* reply, PrinterCommand* cmd,
+                       const char* suffix)
+{
+  if (cmd->code_letter)
+    hostprintf(c, "%s #%d [%c%d]%s\n", reply, cmd->line, cmd->code_letter,
+               cmd->code_number, suffix);
+  else
+    hostprintf(c, "%s #%d [%d]%s\n", reply, cmd->line, cmd->code, suffix);
+}
+
+static void host_default(HostContext* c, PrinterCommand* cmd)
+{
+  if (cmd->type & COMMANDTYPE_UnknownCode)
+  {
+    hostprintf(c, "!! Unknown %c code - %d\n", cmd->code_letter, cmd->code_number);
+  }
+  if (!(cmd->type & COMMANDTYPE_Action))
+  {
+    host_reply(c, "ok", cmd, " {-}");
+  }
+}
+
+static void host_estop_clear(HostContext* c, PrinterCommand* cmd)
+{
+  printerEstopClear();
+  host_default(c, cmd);
+}
+
+static void host_estop(HostContext* c, PrinterCommand* cmd)
+{
+  (void) cmd;
+  printerEstop(L_PRINTER_STOPPED_BY_HOST);
+  hostprintf(c, "ok\n");
+}
+
+static void host_report(HostContext* c, PrinterCommand* cmd)
+{
+  (void) cmd;
+  // Once these commands are received, we will send temp/position report ever now and then
+  c->last_report_time = chTimeNow() - REPORT_INTERVAL;
+  hostprintf(c, "ok\n");
+}
+
+static void host_print_status(HostContext* c, PrinterCommand* cmd)
+{
+  (void) cmd;
+  if (printerGetMainSource() == PRINTINGSOURCE_Storage)
+    hostprintf(c, "SD printing byte %d/%d\n",
+        (int) dataStorageGetCurrentProcessed(), (int) dataStorageGetCurrentFileSize());
+  else
+    hostprintf(c, "Not SD printing\n");
+  int32_t left = printerTimeLeft();
+  if (left >= 0)
+    hostprintf(c, "echo:Time left: %dh %dm\n", left / 3600, left / 60 % 60);
+  hostprintf(c, "ok\n");
+}
+
+static void host_save_settings(HostContext* c, PrinterCommand* cmd)
+{
+  (void) cmd;
+  if (settingsSave())
+    hostprintf(c, "ok\n");
+  else
+    hostprintf(c, "!! Cannot save settings\nok\n");
+}
+
+static void host_telemetry(HostContext* c, PrinterCommand* cmd)
+{
+  if (cmd->s_value < 0 || cmd->s_value > HOST_TELEMETRY_MAX_RATE)
+  {
+    hostprintf(c, "!! Telemetry rate must be 0-%d Hz\n", HOST_TELEMETRY_MAX_RATE);
+  } else if (cmd->s_value < 1) {
+    c->telemetry_interval = 0;
+  } else {
+    c->telemetry_interval = S2ST(1) / (int) cmd->s_value;
+    if (c->telemetry_interval == 0)
+      c->telemetry_interval = 1;
+    c->last_telemetry_time = chTimeNow() - c->telemetry_interval;
+  }
+  hostprintf(c, "ok\n");
+}
+
+static void host_history(HostContext* c, PrinterCommand* cmd)
+{
+  int16_t values[HOST_HISTORY_MAX_ENTRIES];
+  if (cmd->p_value < 0 || cmd->p_value >= RAD_NUMBER_TEMPERATURES)
+  {
+    hostprintf(c, "!! Temperature must be 0-%d\nok\n", RAD_NUMBER_TEMPERATURES - 1);
+    return;
+  }
+  uint32_t seq = cmd->s_value > 0 ? (uint32_t) cmd->s_value : 0;
+  uint16_t n = temperatureGetHistory(cmd->p_value, &seq, values, HOST_HISTORY_MAX_ENTRIES);
+  hostprintf(c, "ok H%u", (unsigned) seq);
+  for (uint16_t i = 0; i < n; i++)
+    hostprintf(c, " %d", values[i]);
+  hostprintf(c, "\n");
+}
+
+static void host_capability(HostContext* c, PrinterCommand* cmd)
+{
+  (void) cmd;
+  hostprintf(c,
+      "ok FIRMWARE_NAME:RAD(marlin) FIRMWARE_URL:http%%3A//rad.hellosam.net/ EXTRUDER_COUNT:%d\n",
+      RAD_NUMBER_EXTRUDERS);
+}
+
+/*
+ * Closes the upload file. error is NULL when all of it was received.
+ */
+static void upload_finish(HostContext* c, const char* error)
+{
+  HostUpload* u = &c->upload;
+  bool_t closed = storageCloseWrite();
+  u->mode = UPLOAD_None;
+  if (error == NULL && !closed)
+    error = "Cannot write file";
+  if (error)
+    hostprintf(c, "!! %s\n", error);
+  else
+    hostprintf(c, "Done saving file. %d bytes\n", (int) u->size);
+}
+
+/*
+ * Appends text to the upload, written out a sector at a time.
+ */
+static bool_t upload_append(HostContext* c, const char* text, size_t len)
+{
+  HostUpload* u = &c->upload;
+  while (len > 0)
+  {
+    size_t n = sizeof(u->data) - u->fill;
+    if (n > len)
+      n = len;
+    memcpy(u->data + u->fill, text, n);
+    u->fill += n;
+    u->size += n;
+    text += n;
+    len -= n;
+    if (u->fill == sizeof(u->data))
+    {
+      if (!storageWrite(u->data, u->fill))
+        return FALSE;
+      u->fill = 0;
+    }
+  }
+  return TRUE;
+}
+
+/*
+ * One line received in text mode, written to the file until M29.
+ */
+static void upload_line(HostContext* c)
+{
+  HostUpload* u = &c->upload;
+  char* line = c->buf;
+  int32_t number = -1;
+  u->last_time = chTimeNow();
+
+  // Line numbers and checksums belong to the connection, not the file
+  if (*line == 'N')
+  {
+    number = strtol(line + 1, &line, 10);
+    while (*line == ' ')
+      line++;
+  }
+  char* star = strchr(line, '*');
+  bool_t valid = TRUE;
+  if (star != NULL)
+  {
+    *star = '\0';
+    valid = u->checksum_end && strtol(star + 1, NULL, 10) == u->checksum;
+  }
+  if (number >= 0)
+  {
+    if (number <= c->last_received_line && valid)
+    {
+      // Written already, our reply was lost
+      hostprintf(c, "ok\n");
+      return;
+    }
+    valid = valid && number == c->last_received_line + 1;
+  }
+  if (!valid)
+  {
+    hostprintf(c, "rs %d Resend:%d\n", c->last_received_line + 1, c->last_received_line + 1);
+    return;
+  }
+  if (number >= 0)
+    c->last_received_line = number;
+
+  if (strncmp(line, "M29", 3) == 0 && (line[3] < '0' || line[3] > '9'))
+  {
+    bool_t ok = u->fill == 0 || storageWrite(u->data, u->fill);
+    upload_finish(c, ok ? NULL : "Cannot write file");
+    hostprintf(c, "ok\n");
+    return;
+  }
+  if (!upload_append(c, line, strlen(line)) || !upload_append(c, "\n", 1))
+    upload_finish(c, "Cannot write file");
+  hostprintf(c, "ok\n");
+}
+
+/*
+ * A complete binary block is in, check and write it.
+ */
+static void upload_block(HostContext* c)
+{
+  HostUpload* u = &c->upload;
+  uint16_t sequence = get_u16(u->header + 1);
+  uint16_t len = get_u16(u->header + 3);
+  u->got = 0;
+
+  uint32_t crc = rad_crc32(0, u->header + 1, HOST_UPLOAD_HEADER_SIZE - 1);
+  if (rad_crc32(crc, u->data, len) != get_u32(u->crc))
+  {
+    hostprintf(c, "rs U%d\n", sequence);
+    return;
+  }
+  if (sequence == (uint16_t) (u->sequence - 1))
+  {
+    // Written already, our reply was lost
+    hostprintf(c, "ok U%d\n", sequence);
+    return;
+  }
+  if (sequence != u->sequence)
+  {
+    hostprintf(c, "rs U%d\n", u->sequence);
+    return;
+  }
+  if (len > 0 && !storageWrite(u->data, len))
+  {
+    upload_finish(c, "Cannot write file");
+    return;
+  }
+  u->sequence++;
+  u->size += len;
+  hostprintf(c, "ok U%d\n", sequence);
+  if (len < HOST_UPLOAD_BLOCK_SIZE)
+    upload_finish(c, NULL);
+}
+
+/*
+ * Takes binary blocks from the received data. Returns the number of
+ * bytes used; the rest is G-code again after the last block.
+ */
+static size_t upload_receive(HostContext* c, const uint8_t* data, size_t n)
+{
+  HostUpload* u = &c->upload;
+  const uint8_t* p = data;
+  const uint8_t* end = data + n;
+
+  u->last_time = chTimeNow();
+  while (p < end && u->mode == UPLOAD_Binary)
+  {
+    if (u->got < HOST_UPLOAD_HEADER_SIZE)
+    {
+      // Skip anything between blocks, such as the end of the M28 line
+      if (u->got == 0 && *p != HOST_UPLOAD_SYNC)
+      {
+        p++;
+        continue;
+      }
+      u->header[u->got++] = *p++;
+      if (u->got == HOST_UPLOAD_HEADER_SIZE &&
+          get_u16(u->header + 3) > HOST_UPLOAD_BLOCK_SIZE)
+      {
+        hostprintf(c, "rs U%d\n", u->sequence);
+        u->got = 0;
+      }
+      continue;
+    }
+
+    uint16_t len = get_u16(u->header + 3);
+    size_t pos = u->got - HOST_UPLOAD_HEADER_SIZE;
+    if (pos < len)
+    {
+      // Straight into the sector buffer
+      size_t take = len - pos;
+      if (take > (size_t) (end - p))
+        take = end - p;
+      memcpy(u->data + pos, p, take);
+      p += take;
+      u->got += take;
+    } else {
+      u->crc[pos - len] = *p++;
+      u->got++;
+      if (pos - len + 1 == sizeof(u->crc))
+        upload_block(c);
+    }
+  }
+  return p - data;
+}
+
+static void host_upload_start(HostContext* c, PrinterCommand* cmd)
+{
+  HostUpload* u = &c->upload;
+  char* name = cmd->string_value;
+  if (name == NULL)
+  {
+    hostprintf(c, "!! No file name\nok\n");
+    return;
+  }
+  bool_t binary = strncmp(name, "B1 ", 3) == 0;
+  if (binary)
+  {
+    name += 3;
+    while (*name == ' ')
+      name++;
+  }
+  char* p = strchr(name, '*');
+  if (p == NULL)
+    p = name + strlen(name);
+  while (p > name && p[-1] == ' ')
+    p--;
+  *p = '\0';
+
+  if (*name == '\0' || !storageCreateFile(name))
+  {
+    hostprintf(c, "!! Cannot open %s\nok\n", name);
+    return;
+  }
+  u->mode = binary ? UPLOAD_Binary : UPLOAD_Text;
+  u->size = 0;
+  u->fill = 0;
+  u->sequence = 0;
+  u->got = 0;
+  u->checksum = 0;
+  u->checksum_end = FALSE;
+  u->last_time = chTimeNow();
+  hostprintf(c, "Writing to file: %s\nok\n", name);
+}
+
+/* Codes handled by the host connection itself, others get host_default */
+static void (* const host_handlers[GCODE_Count])(HostContext* c, PrinterCommand* cmd) = {
+  [GCODE_G28] = host_estop_clear,
+  [GCODE_M999] = host_estop_clear,
+  [GCODE_M112] = host_estop,
+  [GCODE_M105] = host_report,
+  [GCODE_M114] = host_report,
+  [GCODE_M115] = host_capability,
+  [GCODE_M27] = host_print_status,
+  [GCODE_M28] = host_upload_start,
+  [GCODE_M500] = host_save_settings,
+  [GCODE_M1105] = host_telemetry,
+  [GCODE_M1106] = host_history,
+};
 
 static void process_new_line(HostContext* c) {
   PrinterCommand* cmd = &c->command;
 
+  if (c->upload.mode == UPLOAD_Text)
+  {
+    upload_line(c);
+    return;
+  }
+
   bool_t valid = gcodeDecode(cmd, c->buf, &c->decode_context);
   if (cmd->line >= 0)
   {
     // Line number change request
     if (cmd->line == c->last_received_line + 1 ||
         // Line number change request
-        cmd->code == 10110)
+        cmd->code == GCODE_M110)
     {
       c->last_received_line = cmd->line;
     } else if (cmd->line > c->last_received_line + 1)
@@ -75,7 +576,8 @@ static void process_new_line(HostContext* c) {
     }
   }
 
-  RAD_DEBUG_PRINTF("HOST: %s\n", c->buf);
+  if (debug_mirror)
+    RAD_DEBUG_PRINTF("HOST: %s\n", c->buf);
   if (!valid)
   {
     if (!printerIsEstopped())
@@ -90,46 +592,11 @@ static void process_new_line(HostContext* c) {
     return;
   }
 
-  switch (cmd->code)
-  {
-    case 10999: // Estop clear
-    case 28: // Homing
-      printerEstopClear();
-      break;
-  }
-
   /* Host specific Gcode */
-  switch (cmd->code)
-  {
-    case 10112: // EStop
-      printerEstop(L_PRINTER_STOPPED_BY_HOST);
-      hostprintf(c, "ok\n");
-      break;
-    case 10105: // Get temperature
-    case 10114: // Get position
-      // Once these commands are received, we will send temp/position report ever now and then
-      c->last_report_time = chTimeNow() - REPORT_INTERVAL;
-      hostprintf(c, "ok\n");
-      break;
-    case 10115: // Host capability report
-      hostprintf(c,
-          "ok FIRMWARE_NAME:RAD(marlin) FIRMWARE_URL:http%%3A//rad.hellosam.net/ EXTRUDER_COUNT:%d\n",
-          RAD_NUMBER_EXTRUDERS);
-      break;
-    default:
-      if (cmd->type & COMMANDTYPE_UnknownCode)
-      {
-        if (cmd->code < 10000) {
-          hostprintf(c, "!! Unknown G code - %d\n", cmd->code);
-        } else {
-          hostprintf(c, "!! Unknown M code - %d\n", cmd->code - 10000);
-        }
-      }
-      if (!(cmd->type & COMMANDTYPE_Action))
-      {
-        hostprintf(c, "ok #%d [%d] {-}\n", cmd->line, cmd->code);
-      }
-  }
+  if (host_handlers[cmd->code])
+    host_handlers[cmd->code](c, cmd);
+  else
+    host_default(c, cmd);
 
   if (cmd->type & COMMANDTYPE_Action)
   {
@@ -158,6 +625,7 @@ static void process_new_line(HostContext* c) {
           default:
             break;
         }
+        host_flush(c);
         chThdSleepMilliseconds(1000); // Delay to avoid host bursting us
         hostprintf(c, "ok\n");
         return;
@@ -166,7 +634,7 @@ static void process_new_line(HostContext* c) {
 
     c->busy++;
     c->last_busy_time = 0;
-    hostprintf(c, "ack #%d [%d]\n", cmd->line, cmd->code);
+    host_reply(c, "ack", cmd, "");
     cmd->ack_mbox = &c->ack_mbox;
     cmd->ack_evt = &c->ack_evt;
     printerPushCommand(
@@ -178,6 +646,64 @@ static void process_new_line(HostContext* c) {
    */
 }
 
+static void process_block(HostContext* c, const char* data, size_t n)
+{
+  const char* end = data + n;
+  while (data < end)
+  {
+    if (c->upload.mode == UPLOAD_Binary)
+    {
+      data += upload_receive(c, (const uint8_t*) data, end - data);
+      continue;
+    }
+
+    const char* eol = data;
+    while (eol < end && *eol != '\n' && *eol != '\r')
+      eol++;
+
+    // Upload lines are checked against the bytes as sent
+    if (c->upload.mode == UPLOAD_Text)
+    {
+      HostUpload* u = &c->upload;
+      for (const char* p = data; p < eol && !u->checksum_end; p++)
+      {
+        if (*p == '*')
+          u->checksum_end = TRUE;
+        else
+          u->checksum ^= *p;
+      }
+    }
+
+    if (!c->overflow)
+    {
+      // Keep one byte for the terminator
+      int len = gcodeFilterBlock(c->ptr, COMMAND_LENGTH - 1 - (c->ptr - c->buf),
+          data, eol - data, &c->parse_context);
+      if (len < 0)
+      {
+        c->overflow = TRUE;
+        printerEstop(L_PRINTER_LINE_TOO_LONG);
+      } else {
+        c->ptr += len;
+      }
+    }
+    if (eol == end)
+      return;
+
+    // End of line
+    data = eol + 1;
+    c->overflow = FALSE;
+    c->upload.checksum = 0;
+    c->upload.checksum_end = FALSE;
+    gcodeResetParseContext(&c->parse_context);
+    if (c->ptr == c->buf) continue;
+
+    *c->ptr = '\0';
+    process_new_line(c);
+    c->ptr = c->buf;
+  }
+}
+
 static void send_report(HostContext* c) {
   for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++)
   {
@@ -217,6 +743,7 @@ static msg_t threadDataHost(void* arg) {
   memset(&c, 0, sizeof(HostContext));
   c.channel = (BaseAsynchronousChannel*) arg;
 
+  msObjectInit(&c.out, c.out_buffer, OUTPUT_BUFFER_SIZE, 0);
   chMBInit(&c.ack_mbox, c.ack_mbox_buffer, COMMAND_BUFFER_SIZE + 1);
   chEvtInit(&c.ack_evt);
   chEvtRegisterMask(&c.ack_evt, &c.ack_listener, 1);
@@ -225,14 +752,21 @@ static msg_t threadDataHost(void* arg) {
   gcodeResetParseContext(&c.parse_context);
 
   c.ptr = c.buf;
-  while (1)
+  while (!chThdShouldTerminate())
   {
-    eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, MS2ST(200));
+    systime_t timeout = POLL_INTERVAL;
+    if (c.telemetry_interval > 0)
+    {
+      systime_t elapsed = chTimeNow() - c.last_telemetry_time;
+      timeout = elapsed >= c.telemetry_interval ? TIME_IMMEDIATE :
+          c.telemetry_interval - elapsed;
+    }
+    eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, timeout);
     if (events & 1) {
       PrinterCommand* ack_command;
       while (chMBFetch(&c.ack_mbox, (msg_t*) &ack_command, TIME_IMMEDIATE) == RDY_OK)
       {
-        hostprintf(&c, "ok #%d [%d] {+}\n", ack_command->line, ack_command->code);
+        host_reply(&c, "ok", ack_command, " {+}");
         printerFreeCommand(ack_command);
         c.busy--;
       }
@@ -243,38 +777,17 @@ static msg_t threadDataHost(void* arg) {
       if (flags & CHN_CONNECTED) {
         c.last_report_time = 0;
         c.last_busy_time = 0;
+        c.telemetry_interval = 0;
         printerRelease(PRINTINGSOURCE_Host);
+        if (c.upload.mode != UPLOAD_None)
+          upload_finish(&c, "Upload aborted");
         hostprintf(&c, "start\n");
       }
       if (flags & CHN_INPUT_AVAILABLE)
       {
-        while (1)
-        {
-          msg_t i = chnGetTimeout(c.channel, TIME_IMMEDIATE);
-          if (i < 0) break;
-
-          // End of line
-          if (i == '\n' || i == '\r')
-          {
-            gcodeResetParseContext(&c.parse_context);
-            if (c.ptr == c.buf) continue;
-
-            *c.ptr = '\0';
-            process_new_line(&c);
-            c.ptr = c.buf;
-            continue;
-          }
-
-          if ((c.ptr - c.buf) >= COMMAND_LENGTH)
-          {
-            printerEstop(L_PRINTER_LINE_TOO_LONG);
-            continue;
-          }
-
-          i = gcodeFilterCharacter(i, &c.parse_context);
-          if (i)
-            *(c.ptr++) = i;
-        }
+        size_t n;
+        while ((n = chnReadTimeout(c.channel, (uint8_t*) c.rx, READ_BLOCK_SIZE, TIME_IMMEDIATE)) > 0)
+          process_block(&c, c.rx, n);
       }
     }
     if (c.last_report_time > 0&& chTimeNow() - c.last_report_time >= REPORT_INTERVAL)
@@ -282,17 +795,53 @@ static msg_t threadDataHost(void* arg) {
       send_report(&c);
       c.last_report_time += REPORT_INTERVAL;
     }
+    if (c.telemetry_interval > 0 && chTimeNow() - c.last_telemetry_time >= c.telemetry_interval)
+    {
+      send_telemetry(&c);
+      c.last_telemetry_time += c.telemetry_interval;
+      // Skip the missed frames rather than bursting them out
+      if (chTimeNow() - c.last_telemetry_time >= c.telemetry_interval)
+        c.last_telemetry_time = chTimeNow();
+    }
+    if (c.upload.mode != UPLOAD_None && chTimeNow() - c.upload.last_time >= HOST_UPLOAD_TIMEOUT)
+    {
+      c.upload.got = 0;
+      upload_finish(&c, "Upload timed out");
+    }
     if (c.last_busy_time > 0 && chTimeNow() - c.last_busy_time >= IDLE_INTERVAL)
     {
       printerRelease(PRINTINGSOURCE_Host);
       c.last_busy_time = 0;
     }
+    host_flush(&c);
   }
+
+  chEvtUnregister(&c.channel->event, &c.host_listener);
+  chEvtUnregister(&c.ack_evt, &c.ack_listener);
+  printerRelease(PRINTINGSOURCE_Host);
   return 0;
 }
 
+void dataHostSetDebugMirror(bool_t enabled)
+{
+  debug_mirror = enabled;
+}
+
 void dataHostInit(void)
 {
   chThdCreateStatic(waDataHost, sizeof(waDataHost), NORMALPRIO,
       threadDataHost, (void*)radboard.hmi.comm_channel);
 }
+
+#if RAD_TEST
+/*
+ * Starts another host connection on the given channel, used by the host
+ * benchmark. Stop it with chThdTerminate() and chThdWait() once all its
+ * commands are acknowledged.
+ */
+Thread* dataHostCreate(BaseAsynchronousChannel* channel)
+{
+  return chThdCreateFromHeap(NULL, THD_WA_SIZE(DATA_HOST_STACK_SIZE), NORMALPRIO,
+      threadDataHost, (void*)channel);
+}
+#endif
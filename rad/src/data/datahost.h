@@ -21,6 +21,80 @@
 #ifndef _RAD_DATA_HOST_H_
 #define _RAD_DATA_HOST_H_
 
+/*===========================================================================*/
+/* Telemetry frame.                                                          */
+/*===========================================================================*/
+
+/*
+ * "M1105 S<hz>" subscribes the connection to binary telemetry frames,
+ * "M1105 S0" stops them. Frames are interleaved with the text replies.
+ * While subscribed, text bytes from 0x80 up, e.g. UTF-8 in file names,
+ * are sent as '?', so the sync byte only ever starts a frame.
+ *
+ * All fields are little endian:
+ *   u8   sync (HOST_TELEMETRY_SYNC)
+ *   u8   length of the payload that follows, excluding the checksum
+ *   u16  sequence number
+ *   u32  system time (ticks)
+ *   per temperature (RAD_NUMBER_TEMPERATURES):
+ *     s16  pv (0.1 degC)
+ *     s16  sv (0.1 degC)
+ *     u8   heating duty (0-255)
+ *     u8   autotune cycles left, 0 when not tuning (M303)
+ *   per joint (RAD_NUMBER_JOINTS):
+ *     s32  position (um)
+ *   u8   planner queue length
+ *   u16  stepper speed (0.1 mm/s)
+ *   u8   xor of all payload bytes
+ */
+#define HOST_TELEMETRY_SYNC         0xA5
+#define HOST_TELEMETRY_MAX_RATE     100
+#define HOST_TELEMETRY_PAYLOAD_SIZE \
+  (2 + 4 + RAD_NUMBER_TEMPERATURES * 6 + RAD_NUMBER_JOINTS * 4 + 1 + 2)
+#define HOST_TELEMETRY_FRAME_SIZE   (2 + HOST_TELEMETRY_PAYLOAD_SIZE + 1)
+
+/*===========================================================================*/
+/* Temperature history.                                                      */
+/*===========================================================================*/
+
+/*
+ * "M1106 P<temperature> S<seq>" replies with the history of a sensor
+ * from entry seq on, one entry every TEMPERATURE_HISTORY_INTERVAL:
+ *   ok H<seq of the first entry> <0.1 degC> <0.1 degC> ...
+ * At most HOST_HISTORY_MAX_ENTRIES are sent. The first seq is later than
+ * asked for when those entries are gone, and the next request continues
+ * from it plus the entries received. "S0" fetches all that is kept.
+ */
+#define HOST_HISTORY_MAX_ENTRIES    60
+
+/*===========================================================================*/
+/* File upload.                                                              */
+/*===========================================================================*/
+
+/*
+ * "M28 <file>" writes the lines that follow to a file on the card until
+ * "M29", as other firmwares do. Lines with a wrong checksum or line
+ * number are asked for again with "rs". "M28 B1 <file>" sends the file
+ * as binary blocks instead, ending with a block shorter than
+ * HOST_UPLOAD_BLOCK_SIZE (empty if the size is a multiple of it).
+ *
+ * All fields are little endian:
+ *   u8   sync (HOST_UPLOAD_SYNC)
+ *   u16  sequence number, from 0
+ *   u16  length of the data (0-HOST_UPLOAD_BLOCK_SIZE)
+ *   data
+ *   u32  CRC-32 of the sequence number, length and data
+ *
+ * Each block is answered with "ok U<seq>", or "rs U<seq>" naming the
+ * block to send again. Full blocks are one sector, written to the card
+ * without copying. Either upload is dropped after HOST_UPLOAD_TIMEOUT
+ * without data. The file being printed cannot be uploaded to.
+ */
+#define HOST_UPLOAD_SYNC            0xA6
+#define HOST_UPLOAD_BLOCK_SIZE      STORAGE_BLOCK_SIZE
+#define HOST_UPLOAD_HEADER_SIZE     5
+#define HOST_UPLOAD_TIMEOUT         S2ST(5)
+
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
@@ -29,6 +103,10 @@
 extern "C" {
 #endif
   void dataHostInit(void);
+  void dataHostSetDebugMirror(bool_t enabled);
+#if RAD_TEST
+  Thread* dataHostCreate(BaseAsynchronousChannel* channel);
+#endif
 #ifdef __cplusplus
 }
 #endif
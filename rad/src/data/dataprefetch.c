@@ -0,0 +1,191 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Storage read-ahead
+ *
+ * The prefetch thread keeps a ring of DATA_PREFETCH_BLOCKS sectors filled
+ * ahead of the storage parser, reading every free sector up to the end of
+ * the ring in one request so FatFs can issue multi-block reads. The parser
+ * takes the data straight out of the ring and never waits for the card.
+ *
+ * filled and consumed are running byte counts, the ring position is the
+ * count modulo DATA_PREFETCH_SIZE. Reads are whole sectors until the end
+ * of the file, so filled stays sector aligned.
+ */
+
+#include "ch.h"
+#include "rad.h"
+
+EventSource prefetch_evt;
+
+static WORKING_AREA(waDataPrefetch, 256);
+static BinarySemaphore wakeup;
+/* Held by the prefetch thread while it works on the file */
+static Mutex read_mutex;
+
+static char buffer[DATA_PREFETCH_SIZE];
+static uint32_t filled;
+static uint32_t consumed;
+static bool_t stalled;
+static DataPrefetchStats stats;
+
+static msg_t threadDataPrefetch(void* arg) {
+  (void) arg;
+  chRegSetThreadName("data-prefetch");
+
+  while (1) {
+    chBSemWait(&wakeup);
+    chMtxLock(&read_mutex);
+    while (1) {
+      chSysLock();
+      bool_t reading = stats.state == PREFETCH_Reading;
+      uint32_t free = DATA_PREFETCH_SIZE - (filled - consumed);
+      uint32_t pos = filled % DATA_PREFETCH_SIZE;
+      chSysUnlock();
+      if (!reading || free < STORAGE_BLOCK_SIZE)
+        break;
+
+      // Every free sector up to the end of the ring
+      uint32_t len = free - free % STORAGE_BLOCK_SIZE;
+      if (len > DATA_PREFETCH_SIZE - pos)
+        len = DATA_PREFETCH_SIZE - pos;
+
+      systime_t time = chTimeNow();
+      int n = storageRead(buffer + pos, len);
+      time = chTimeNow() - time;
+
+      chSysLock();
+      // Stopped while reading, the data belongs to nobody
+      if (stats.state == PREFETCH_Reading) {
+        stats.reads++;
+        if (time > stats.max_read_time)
+          stats.max_read_time = time;
+        if (n == STORAGE_EOF) {
+          stats.state = PREFETCH_Eof;
+        } else if (n == STORAGE_ERROR) {
+          stats.state = PREFETCH_Error;
+        } else {
+          filled += n;
+          stalled = FALSE;
+        }
+        chEvtBroadcastFlagsI(&prefetch_evt, DATA_PREFETCH_AVAILABLE);
+        chSchRescheduleS();
+      }
+      chSysUnlock();
+    }
+    chMtxUnlock();
+  }
+  return 0;
+}
+
+/*===========================================================================*/
+/* Exported functions.                                                       */
+/*===========================================================================*/
+
+/*
+ * Starts reading the currently opened file from where it is positioned,
+ * the beginning or the layer datastorage.c moved it to.
+ */
+void dataPrefetchStart(void)
+{
+  dataPrefetchStop();
+  chSysLock();
+  filled = 0;
+  consumed = 0;
+  stalled = FALSE;
+  memset(&stats, 0, sizeof(stats));
+  stats.min_fill = DATA_PREFETCH_SIZE;
+  stats.state = PREFETCH_Reading;
+  chSysUnlock();
+  chBSemSignal(&wakeup);
+}
+
+/*
+ * Stops reading. Returns once the read in progress, if any, is finished,
+ * so the file can be closed or reopened.
+ */
+void dataPrefetchStop(void)
+{
+  chSysLock();
+  stats.state = PREFETCH_Idle;
+  chSysUnlock();
+  chMtxLock(&read_mutex);
+  chMtxUnlock();
+}
+
+/*
+ * Returns the number of bytes that can be taken in one go at *data,
+ * 0 if there is nothing buffered. Does not block.
+ */
+size_t dataPrefetchPeek(const char** data)
+{
+  chSysLock();
+  uint32_t pos = consumed % DATA_PREFETCH_SIZE;
+  uint32_t avail = filled - consumed;
+  if (avail > DATA_PREFETCH_SIZE - pos)
+    avail = DATA_PREFETCH_SIZE - pos;
+  if (avail == 0 && stats.state == PREFETCH_Reading && filled > 0 && !stalled) {
+    stalled = TRUE;
+    stats.stalls++;
+  }
+  chSysUnlock();
+  *data = buffer + pos;
+  return avail;
+}
+
+void dataPrefetchConsume(size_t n)
+{
+  chSysLock();
+  bool_t freed_block = (consumed + n) / STORAGE_BLOCK_SIZE != consumed / STORAGE_BLOCK_SIZE;
+  consumed += n;
+  if (stats.state == PREFETCH_Reading && filled - consumed < stats.min_fill)
+    stats.min_fill = filled - consumed;
+  if (freed_block) {
+    chBSemSignalI(&wakeup);
+    chSchRescheduleS();
+  }
+  chSysUnlock();
+}
+
+DataPrefetchState dataPrefetchGetState(void)
+{
+  DataPrefetchState state;
+  chSysLock();
+  state = stats.state;
+  chSysUnlock();
+  return state;
+}
+
+void dataPrefetchGetStats(DataPrefetchStats* s)
+{
+  chSysLock();
+  *s = stats;
+  s->fill = filled - consumed;
+  chSysUnlock();
+}
+
+void dataPrefetchInit(void)
+{
+  chEvtInit(&prefetch_evt);
+  chBSemInit(&wakeup, TRUE);
+  chMtxInit(&read_mutex);
+  chThdCreateStatic(waDataPrefetch, sizeof(waDataPrefetch), NORMALPRIO - 15,
+      threadDataPrefetch, NULL);
+}
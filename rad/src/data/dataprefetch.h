@@ -0,0 +1,78 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+#ifndef _RAD_DATA_PREFETCH_H_
+#define _RAD_DATA_PREFETCH_H_
+
+#include "storage.h"
+
+/*===========================================================================*/
+/* Data structures and types.                                                */
+/*===========================================================================*/
+
+#ifndef DATA_PREFETCH_BLOCKS
+#define DATA_PREFETCH_BLOCKS 8
+#endif
+#define DATA_PREFETCH_SIZE (DATA_PREFETCH_BLOCKS * STORAGE_BLOCK_SIZE)
+
+/* Flag broadcast on prefetch_evt whenever a read completes */
+#define DATA_PREFETCH_AVAILABLE 1
+
+typedef enum {
+  PREFETCH_Idle = 0,
+  PREFETCH_Reading = 1,
+  PREFETCH_Eof = 2,
+  PREFETCH_Error = 3
+} DataPrefetchState;
+
+typedef struct {
+  DataPrefetchState state;
+  /** Bytes buffered ahead of the parser **/
+  uint32_t fill;
+  /** Lowest fill seen while the file was still being read **/
+  uint32_t min_fill;
+  /** Times the parser found the buffer empty while the file was being read **/
+  uint32_t stalls;
+  uint32_t reads;
+  /** Slowest single read, in system ticks **/
+  systime_t max_read_time;
+} DataPrefetchStats;
+
+extern EventSource prefetch_evt;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void dataPrefetchInit(void);
+  void dataPrefetchStart(void);
+  void dataPrefetchStop(void);
+  size_t dataPrefetchPeek(const char** data);
+  void dataPrefetchConsume(size_t n);
+  DataPrefetchState dataPrefetchGetState(void);
+  void dataPrefetchGetStats(DataPrefetchStats* stats);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RAD_DATA_PREFETCH_H_ */
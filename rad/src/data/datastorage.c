@@ -27,11 +27,32 @@ EventSource storage_evt;
 
 #define COMMAND_LENGTH 128
 
+/*
+ * Commands pushed but not yet acknowledged. Bounded by the ack mailbox so
+ * the printer thread never blocks returning a command to us, and leaves
+ * the rest of the command pool to the other sources.
+ */
+#define STORAGE_IN_FLIGHT (COMMAND_BUFFER_SIZE + 1)
+
+typedef enum {
+  FORMAT_Unknown = 0,
+  FORMAT_Text = 1,
+  /* Pre-compiled, see gcode_binary.h */
+  FORMAT_Binary = 2
+} StorageFormat;
+
+typedef enum {
+  FEED_Line = 0,
+  FEED_Stalled = 1,
+  FEED_Finished = 2
+} FeedResult;
+
 typedef struct {
   EventSource ack_evt;
   EventListener ack_listener;
   EventListener status_listener;
-  msg_t ack_mbox_buffer[COMMAND_BUFFER_SIZE + 1];
+  EventListener prefetch_listener;
+  msg_t ack_mbox_buffer[STORAGE_IN_FLIGHT];
   Mailbox ack_mbox;
 
   decode_context_t decode_context;
@@ -39,6 +60,23 @@ typedef struct {
 
   uint32_t line;
   uint32_t processed_len;
+  uint32_t in_flight;
+  bool_t stalled;
+  StorageFormat format;
+  /* Offset of the binary file index */
+  uint32_t records_end;
+  uint32_t layer_count;
+  /* Bytes to drop before the first record after a seek */
+  uint32_t skip;
+
+  /* Layer tracking, see gcode_binary.h for what starts a layer */
+  int8_t z_axis;
+  bool_t relative;
+  bool_t relative_e;
+  float z;
+  float e;
+  float layer_z;
+  uint32_t layer;
 
   char* ptr;
   char buf[COMMAND_LENGTH];
@@ -47,142 +85,481 @@ typedef struct {
 
 uint32_t file_size;
 uint32_t processed_len;
+static uint32_t current_layer;
+static uint32_t layer_count;
+static uint32_t start_layer;
 
 static WORKING_AREA(waDataStorage, 256 + sizeof(StorageContext));
 
-static void process_new_line(StorageContext* c) {
+static void track_layer(StorageContext* c, const PrinterCommand* cmd) {
+  if (cmd->printer.distance)
+    c->relative = cmd->printer.distance == DISTANCEMODE_Relative;
+  if (cmd->printer.extruder_distance)
+    c->relative_e = cmd->printer.extruder_distance == DISTANCEMODE_Relative;
 
-  PrinterCommand* cmd = &c->command;
+  float z = c->z_axis >= 0 ? cmd->axes_value[c->z_axis] : NAN;
+  switch (cmd->code) {
+  case GCODE_G92:
+    if (!isnan(z)) c->z = z;
+    if (!isnan(cmd->e_value)) c->e = cmd->e_value;
+    return;
+  case GCODE_G28:
+  {
+    // Without axis words every axis is homed
+    bool_t all = TRUE;
+    for (uint8_t i = 0; i < RAD_NUMBER_AXES; i++)
+      if (!isnan(cmd->axes_value[i])) all = FALSE;
+    if (all || !isnan(z))
+      c->z = 0;
+    return;
+  }
+  case GCODE_G10:
+    return;
+  default:
+    break;
+  }
 
-  bool_t valid = gcodeDecode(cmd, c->buf, &c->decode_context);
+  if (!isnan(z))
+    c->z = c->relative ? c->z + z : z;
+  if (isnan(cmd->e_value))
+    return;
+  float e = c->e;
+  c->e = c->relative_e ? e + cmd->e_value : cmd->e_value;
+  if (c->e <= e || (c->layer > 0 && c->z <= c->layer_z))
+    return;
+  c->layer++;
+  c->layer_z = c->z;
+}
+
+static void process_command(StorageContext* c, bool_t valid) {
+
+  PrinterCommand* cmd = &c->command;
 
-  RAD_DEBUG_PRINTF("STORAGE: %s\n", c->buf);
   if (!valid) {
     printerEstopFormatted(L_PRINTER_STORAGE_GCODE_ERROR, c->line);
     return;
   }
 
   switch (cmd->code) {
-  case 10999: // Estop clear
+  case GCODE_M999: // Estop clear
     printerEstopClear();
     break;
-  case 10112: // EStop
+  case GCODE_M112: // EStop
     printerEstop(L_PRINTER_STOPPED_BY_STORAGE);
     break;
+  default:
+    break;
   }
 
   if (cmd->type & COMMANDTYPE_Action) {
+    track_layer(c, cmd);
     cmd->ack_mbox = &c->ack_mbox;
     cmd->ack_evt = &c->ack_evt;
+    c->in_flight++;
     printerPushCommand(PRINTINGSOURCE_Storage, cmd);
   }
 }
 
+static void process_new_line(StorageContext* c) {
+  bool_t valid = gcodeDecode(&c->command, c->buf, &c->decode_context);
+  RAD_DEBUG_PRINTF("STORAGE: %s\n", c->buf);
+  process_command(c, valid);
+}
+
+/*
+ * Handles an empty prefetch buffer. Returns FEED_Stalled if more data
+ * is on the way, FEED_Finished otherwise.
+ */
+static FeedResult handle_no_data(StorageContext* c) {
+  switch (dataPrefetchGetState()) {
+  case PREFETCH_Error:
+    printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, c->line);
+    return FEED_Finished;
+  case PREFETCH_Eof:
+    if (c->format == FORMAT_Binary) {
+      // The records end before the index
+      printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, c->line);
+      return FEED_Finished;
+    }
+    // Last line without a line break
+    if (c->ptr != c->buf) {
+      *c->ptr = '\0';
+      process_new_line(c);
+      c->ptr = c->buf;
+    }
+    printerRelease(PRINTINGSOURCE_Storage);
+    return FEED_Finished;
+  default:
+    // The card is behind, wait for the next read
+    return FEED_Stalled;
+  }
+}
+
+/*
+ * Scans the next line out of the prefetch buffer and processes it.
+ * Returns FEED_Finished when the file is finished or cannot be read any
+ * further, FEED_Stalled without processing a line if the buffer ran dry.
+ */
+static FeedResult process_next_line(StorageContext* c) {
+  while (1)
+  {
+    const char* start;
+    size_t avail = dataPrefetchPeek(&start);
+    if (avail == 0)
+      return handle_no_data(c);
+
+    const char* end = start + avail;
+    const char* eol = start;
+    while (eol < end && *eol != '\n' && *eol != '\r')
+      eol++;
+
+    // Keep one byte for the terminator
+    int len = gcodeFilterBlock(c->ptr, COMMAND_LENGTH - 1 - (c->ptr - c->buf),
+        start, eol - start, &c->parse_context);
+    if (len < 0) {
+      printerEstopFormatted(L_PRINTER_FILE_LINE_TOO_LONG, c->line);
+      return FEED_Finished;
+    }
+    c->ptr += len;
+    if (eol == end) {
+      c->processed_len += avail;
+      dataPrefetchConsume(avail);
+      continue;
+    }
+
+    // End of line
+    c->processed_len += eol - start + 1;
+    dataPrefetchConsume(eol - start + 1);
+    c->line++;
+    gcodeResetParseContext(&c->parse_context);
+    if (c->ptr == c->buf) continue;
+
+    *c->ptr = '\0';
+    process_new_line(c);
+    c->ptr = c->buf;
+    return FEED_Line;
+  }
+}
+
+/*
+ * Gathers the next record of a pre-compiled file in c->buf and
+ * processes it. Records can span the end of the prefetch ring.
+ */
+static FeedResult process_next_record(StorageContext* c) {
+  while (1)
+  {
+    size_t have = c->ptr - c->buf;
+    size_t need = GCODEBIN_RECORD_HEADER_SIZE;
+    if (have >= GCODEBIN_RECORD_HEADER_SIZE) {
+      need = GCODEBIN_RECORD_SIZE(c->buf);
+      if (need > GCODEBIN_RECORD_MAX_SIZE) {
+        printerEstopFormatted(L_STORAGE_FILE_FORMAT_ERROR, c->line);
+        return FEED_Finished;
+      }
+    }
+    if (have == need)
+      break;
+
+    if (c->processed_len == c->records_end) {
+      if (have > 0) {
+        printerEstopFormatted(L_STORAGE_FILE_FORMAT_ERROR, c->line);
+        return FEED_Finished;
+      }
+      printerRelease(PRINTINGSOURCE_Storage);
+      return FEED_Finished;
+    }
+
+    const char* start;
+    size_t avail = dataPrefetchPeek(&start);
+    if (avail == 0)
+      return handle_no_data(c);
+
+    size_t len = need - have;
+    if (len > avail)
+      len = avail;
+    if (len > c->records_end - c->processed_len)
+      len = c->records_end - c->processed_len;
+    memcpy(c->ptr, start, len);
+    c->ptr += len;
+    c->processed_len += len;
+    dataPrefetchConsume(len);
+  }
+
+  const uint8_t* record = (const uint8_t*) c->buf;
+  c->line += GCODEBIN_U16(record + 2);
+  c->ptr = c->buf;
+  process_command(c, gcodeDecodeBinary(&c->command, record));
+  return FEED_Line;
+}
+
+/*
+ * Takes the header of a pre-compiled file. Returns FALSE if it is not
+ * one this reader understands.
+ */
+static bool_t read_binary_header(StorageContext* c, const char* header) {
+  if (memcmp(header, GCODEBIN_MAGIC, 4) != 0 ||
+      GCODEBIN_U16(header + 4) != GCODEBIN_VERSION ||
+      GCODEBIN_U32(header + 12) < GCODEBIN_HEADER_SIZE)
+    return FALSE;
+  c->format = FORMAT_Binary;
+  c->records_end = GCODEBIN_U32(header + 12);
+  c->layer_count = GCODEBIN_U32(header + 24);
+  // Progress runs up to the index
+  chSysLock();
+  if (c->records_end < file_size)
+    file_size = c->records_end;
+  chSysUnlock();
+  return TRUE;
+}
+
+/*
+ * Positions the file to print from the given layer, counted from 1.
+ * Layer 0 and 1 start at the beginning, later layers are looked up in
+ * the layer table of a pre-compiled file.
+ */
+static bool_t seek_layer(StorageContext* c, uint32_t layer) {
+  if (!storageSeek(0)) {
+    printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, 0);
+    return FALSE;
+  }
+  if (layer <= 1)
+    return TRUE;
+
+  char header[GCODEBIN_HEADER_SIZE];
+  char entry[GCODEBIN_LAYER_SIZE];
+  if (storageRead(header, sizeof(header)) != sizeof(header) ||
+      !read_binary_header(c, header) || layer > c->layer_count) {
+    printerEstopFormatted(L_STORAGE_LAYER_ERROR, layer);
+    return FALSE;
+  }
+  uint32_t table = c->records_end + 8 * GCODEBIN_U32(header + 16);
+  if (!storageSeek(table + (layer - 1) * GCODEBIN_LAYER_SIZE) ||
+      storageRead(entry, sizeof(entry)) != sizeof(entry)) {
+    printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, 0);
+    return FALSE;
+  }
+
+  // Reads stay sector aligned, the parser drops the rest
+  uint32_t offset = GCODEBIN_U32(entry);
+  c->skip = offset % STORAGE_BLOCK_SIZE;
+  c->processed_len = offset - c->skip;
+  if (offset < GCODEBIN_HEADER_SIZE || offset >= c->records_end ||
+      !storageSeek(c->processed_len)) {
+    printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, 0);
+    return FALSE;
+  }
+  // The line before the record, reading the record adds its own
+  c->line = GCODEBIN_U32(entry + 4);
+  c->z = (float) (int32_t) GCODEBIN_U32(entry + 8) / GCODEBIN_SCALE;
+  c->layer = layer - 1;
+  c->layer_z = -INFINITY;
+
+  // The modes set by the part skipped, they come first
+  uint32_t modes = GCODEBIN_U32(entry + 16);
+  int32_t feedrate = (int32_t) GCODEBIN_U32(entry + 20);
+  uint8_t mode_record[GCODEBIN_RECORD_HEADER_SIZE + 3 * 3 + 4] = {
+    0, 0, 0, 0, 3,
+    'M', modes & GCODEBIN_MODE_RELATIVE_E ? 83 : 82, 0,
+    'G', modes & GCODEBIN_MODE_RELATIVE ? 91 : 90, 0,
+    'G', modes & GCODEBIN_MODE_INCHES ? 20 : 21, 0,
+    feedrate & 0xFF, (feedrate >> 8) & 0xFF, (feedrate >> 16) & 0xFF, (feedrate >> 24) & 0xFF
+  };
+  if (feedrate > 0)
+    mode_record[0] = GCODEBIN_WORD_F;
+  process_command(c, gcodeDecodeBinary(&c->command, mode_record));
+
+  // Put the extruder where the layer expects it
+  int32_t e = (int32_t) GCODEBIN_U32(entry + 12);
+  if (e != GCODEBIN_NO_E)
+  {
+    uint8_t record[GCODEBIN_RECORD_HEADER_SIZE + 3 + 4] = {
+      GCODEBIN_WORD_E, 0, 0, 0, 1, 'G', 92, 0,
+      e & 0xFF, (e >> 8) & 0xFF, (e >> 16) & 0xFF, (e >> 24) & 0xFF
+    };
+    process_command(c, gcodeDecodeBinary(&c->command, record));
+  }
+  return TRUE;
+}
+
+/*
+ * Picks the reader from the start of the file. Pre-compiled files begin
+ * with GCODEBIN_MAGIC, anything else is read as G-code text.
+ */
+static FeedResult process_next(StorageContext* c) {
+  while (c->skip > 0)
+  {
+    const char* start;
+    size_t avail = dataPrefetchPeek(&start);
+    if (avail == 0)
+      return handle_no_data(c);
+    if (avail > c->skip)
+      avail = c->skip;
+    c->skip -= avail;
+    c->processed_len += avail;
+    dataPrefetchConsume(avail);
+  }
+
+  if (c->format == FORMAT_Unknown)
+  {
+    const char* start;
+    size_t avail = dataPrefetchPeek(&start);
+    if (avail == 0 && dataPrefetchGetState() == PREFETCH_Reading)
+      return FEED_Stalled;
+
+    c->format = FORMAT_Text;
+    // The first read is a whole sector unless the file is smaller
+    if (avail >= GCODEBIN_HEADER_SIZE &&
+        memcmp(start, GCODEBIN_MAGIC, 4) == 0)
+    {
+      if (!read_binary_header(c, start)) {
+        printerEstopFormatted(L_STORAGE_FILE_FORMAT_ERROR, 0);
+        return FEED_Finished;
+      }
+      c->processed_len = GCODEBIN_HEADER_SIZE;
+      dataPrefetchConsume(GCODEBIN_HEADER_SIZE);
+    }
+  }
+
+  if (c->format == FORMAT_Binary)
+    return process_next_record(c);
+  return process_next_line(c);
+}
+
+/*
+ * Stops reading and closes the file, uploads may replace it again.
+ */
+static void print_end(StorageContext* c) {
+  c->line = 0;
+  dataPrefetchStop();
+  storageCloseFile();
+}
+
 static msg_t threadDataStorage(void* arg) {
   (void) arg;
   chRegSetThreadName("data-storage");
 
   StorageContext c;
   memset(&c, 0, sizeof(StorageContext));
-  chMBInit(&c.ack_mbox, c.ack_mbox_buffer, COMMAND_BUFFER_SIZE + 1);
+  chMBInit(&c.ack_mbox, c.ack_mbox_buffer, STORAGE_IN_FLIGHT);
   chEvtInit(&c.ack_evt);
   chEvtRegisterMask(&c.ack_evt, &c.ack_listener, 1);
   chEvtRegisterMaskWithFlags(&storage_evt, &c.status_listener, 2,
       STORAGE_START | STORAGE_STOP);
+  c.z_axis = -1;
+  for (uint8_t i = 0; i < RAD_NUMBER_AXES; i++)
+    if (machine.kinematics.axes[i].name == AXIS_Z)
+      c.z_axis = i;
+  chEvtRegisterMaskWithFlags(&prefetch_evt, &c.prefetch_listener, 4,
+      DATA_PREFETCH_AVAILABLE);
 
   while (1) {
-    eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, c.line > 0 ? MS2ST(5) : MS2ST(500));
+    /*
+     * While printing, only sleep when there is nothing to do: every
+     * command slot is waiting for the printer (woken by an ack) or the
+     * card is behind (woken by the prefetch thread).
+     */
+    systime_t timeout = MS2ST(500);
+    if (c.line && !c.stalled && c.in_flight < STORAGE_IN_FLIGHT)
+      timeout = TIME_IMMEDIATE;
+    eventmask_t events = chEvtWaitAnyTimeout(ALL_EVENTS, timeout);
     if (events & 1) {
       PrinterCommand* ack_command;
       while (chMBFetch(&c.ack_mbox, (msg_t*) &ack_command, TIME_IMMEDIATE)
           == RDY_OK) {
         printerFreeCommand(ack_command);
+        c.in_flight--;
       }
     }
+    if (events & 4) {
+      chEvtGetAndClearFlags(&c.prefetch_listener);
+      c.stalled = FALSE;
+    }
     if (events & 2) {
       flagsmask_t flags = chEvtGetAndClearFlags(&c.status_listener);
       if (flags & STORAGE_START) {
+        chSysLock();
+        uint32_t layer = start_layer;
+        start_layer = 0;
+        chSysUnlock();
         if (printerTryAcquire(PRINTINGSOURCE_Storage))
         {
           c.processed_len = 0;
           c.line = 1;
           c.ptr = c.buf;
+          c.stalled = FALSE;
+          c.format = FORMAT_Unknown;
+          c.layer_count = 0;
+          c.skip = 0;
+          c.relative = FALSE;
+          c.relative_e = FALSE;
+          c.z = 0;
+          c.e = 0;
+          c.layer = 0;
           gcodeResetParseContext(&c.parse_context);
-          printerTimeStart();
+          if (seek_layer(&c, layer)) {
+            dataPrefetchStart();
+            printerTimeStart();
+          } else {
+            print_end(&c);
+          }
+        } else if (!c.line) {
+          storageCloseFile();
         }
       }
       if (flags & STORAGE_STOP) {
-        c.line = 0;
+        print_end(&c);
         printerRelease(PRINTINGSOURCE_Storage);
       }
     }
     if (c.line)
     {
       if (printerIsEstopped()) {
-        c.line = 0;
+        print_end(&c);
         continue;
       }
 
-      while (1)
-      {
-        int i = storageReadChar();
-
-        if (i == STORAGE_ERROR) {
-        printerEstopFormatted(L_STORAGE_FILE_READ_ERROR, c.line);
-          break;
-      }
-        if (i == STORAGE_EOF) {
-        printerRelease(PRINTINGSOURCE_Storage);
-          break;
-      }
-        c.processed_len++;
-
-        // End of line
-        if (i == '\n' || i == '\r')
-        {
-          c.line++;
-      gcodeResetParseContext(&c.parse_context);
-          if (c.ptr == c.buf) continue;
-
-          *c.ptr = '\0';
-          process_new_line(&c);
-          c.ptr = c.buf;
-          break;
+      // Parse ahead until the command slots are used up
+      while (c.in_flight < STORAGE_IN_FLIGHT && !printerIsEstopped()) {
+        FeedResult result = process_next(&c);
+        if (result == FEED_Stalled) {
+          c.stalled = TRUE;
+        } else if (result == FEED_Finished) {
+          print_end(&c);
         }
-
-        if ((c.ptr - c.buf) >= COMMAND_LENGTH)
-      {
-          printerEstopFormatted(L_PRINTER_FILE_LINE_TOO_LONG, c.line);
+        if (result != FEED_Line)
           break;
       }
-
-        i = gcodeFilterCharacter(i, &c.parse_context);
-        if (i)
-          *(c.ptr++) = i;
-      }
       chSysLock();
       processed_len = c.processed_len;
+      current_layer = c.layer;
+      layer_count = c.layer_count;
       chSysUnlock();
     }
   }
   return 0;
 }
 
-void dataStorageSelect(const char* filename)
+/*
+ * Opens a file to print. Returns FALSE, with the printer estopped, if it
+ * cannot be printed now.
+ */
+bool_t dataStorageSelect(const char* filename)
 {
   if (printerGetState() != PRINTERSTATE_Standby)
   {
     printerEstop(L_STORAGE_NOT_IN_STANDBY);
-    return;
+    return FALSE;
   }
-  chSysLock();
-  if (!storageOpenFile(filename, &file_size)) {
+  uint32_t size;
+  if (!storageOpenFile(filename, &size)) {
     printerEstop(L_STORAGE_FILE_OPEN_ERROR);
-    chSysUnlock();
-    return;
+    return FALSE;
   }
+  chSysLock();
+  file_size = size;
   chSysUnlock();
   uiStateSetActiveFilename(filename);
+  return TRUE;
 }
 
 uint32_t dataStorageGetCurrentFileSize(void)
@@ -203,8 +580,41 @@ uint32_t dataStorageGetCurrentProcessed(void)
   return s;
 }
 
+uint32_t dataStorageGetCurrentLayer(void)
+{
+  uint32_t s;
+  chSysLock();
+  s = current_layer;
+  chSysUnlock();
+  return s;
+}
+
+/*
+ * Returns the number of layers of a pre-compiled file, 0 if unknown.
+ */
+uint32_t dataStorageGetLayerCount(void)
+{
+  uint32_t s;
+  chSysLock();
+  s = layer_count;
+  chSysUnlock();
+  return s;
+}
+
 void dataStoragePrintStart(void)
 {
+  dataStoragePrintStartAt(0);
+}
+
+/*
+ * Starts printing from the given layer, counted from 1. Seeking needs a
+ * pre-compiled file. The printer must be homed and heated already.
+ */
+void dataStoragePrintStartAt(uint32_t layer)
+{
+  chSysLock();
+  start_layer = layer;
+  chSysUnlock();
   chEvtBroadcastFlags(&storage_evt, STORAGE_START);
 }
 
@@ -216,6 +626,7 @@ void dataStoragePrintStop(void)
 void dataStorageInit(void)
 {
   chEvtInit(&storage_evt);
+  dataPrefetchInit();
   chThdCreateStatic(waDataStorage, sizeof(waDataStorage), NORMALPRIO - 20,
       threadDataStorage, NULL);
 }
@@ -31,10 +31,13 @@
 extern "C" {
 #endif
   void dataStorageInit(void);
-  void dataStorageSelect(const char* file);
+  bool_t dataStorageSelect(const char* file);
   uint32_t dataStorageGetCurrentFileSize(void);
   uint32_t dataStorageGetCurrentProcessed(void);
+  uint32_t dataStorageGetCurrentLayer(void);
+  uint32_t dataStorageGetLayerCount(void);
   void dataStoragePrintStart(void);
+  void dataStoragePrintStartAt(uint32_t layer);
   void dataStoragePrintStop(void);
 #ifdef __cplusplus
 }
@@ -0,0 +1,444 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Host loopback benchmark
+ *
+ * Streams a G-code file from test/ through an in-memory channel into a
+ * second data host thread, the same way a host program would over USB,
+ * and reports the sustained line rate, the latency between sending a
+ * line and receiving its "ok", and the planner queue fill over time.
+ *
+ *   bench_host <file> [window] [none|line|checksum]
+ *
+ * window   - Number of lines sent ahead without waiting for an "ok". The
+ *            data host drops a sync action, e.g. a move or M109, sent
+ *            while another is in flight, so those wait for the window
+ *            to drain, and a "busy" reply aborts the run.
+ * none     - Plain lines
+ * line     - Lines are prefixed by "N<line>"
+ * checksum - As line, with a "*<checksum>" suffix
+ */
+
+#include "rad.h"
+#include <stdlib.h>
+
+#if RAD_TEST
+
+#include <stdio.h>
+
+#define BENCH_BUFFER_SIZE       1024
+#define BENCH_LINE_LENGTH       128
+#define BENCH_MAX_WINDOW        8
+#define BENCH_LATENCY_BUCKETS   500
+#define BENCH_FILL_SECONDS      60
+#define BENCH_REPLY_TIMEOUT     S2ST(5)
+
+#define BENCH_ST2MS(t) ((uint32_t) (t) * 1000 / CH_FREQUENCY)
+
+typedef enum {
+  BENCH_Plain = 0,
+  BENCH_LineNumber = 1,
+  BENCH_Checksum = 2
+} BenchMode;
+
+/*===========================================================================*/
+/* Loopback channel.                                                         */
+/*===========================================================================*/
+
+struct LoopbackChannelVMT {
+  _base_asynchronous_channel_methods
+};
+
+typedef struct {
+  const struct LoopbackChannelVMT *vmt;
+  _base_asynchronous_channel_data
+  /** Host to firmware **/
+  InputQueue rx;
+  uint8_t rx_buffer[BENCH_BUFFER_SIZE];
+  /** Firmware to host **/
+  InputQueue tx;
+  uint8_t tx_buffer[BENCH_BUFFER_SIZE];
+} LoopbackChannel;
+
+/* Puts the bytes into the queue, waiting for the reader when it is full */
+static void loopback_push(InputQueue* q, const uint8_t* bp, size_t n)
+{
+  chSysLock();
+  while (n > 0)
+  {
+    if (chIQPutI(q, *bp) == Q_FULL)
+    {
+      chSysUnlock();
+      chThdSleepMilliseconds(1);
+      chSysLock();
+      continue;
+    }
+    bp++;
+    n--;
+  }
+  chSysUnlock();
+}
+
+static size_t loopback_writet(void *ip, const uint8_t *bp, size_t n, systime_t time)
+{
+  (void) time;
+  loopback_push(&((LoopbackChannel*) ip)->tx, bp, n);
+  return n;
+}
+
+static size_t loopback_readt(void *ip, uint8_t *bp, size_t n, systime_t time)
+{
+  return chIQReadTimeout(&((LoopbackChannel*) ip)->rx, bp, n, time);
+}
+
+static msg_t loopback_putt(void *ip, uint8_t b, systime_t time)
+{
+  loopback_writet(ip, &b, 1, time);
+  return Q_OK;
+}
+
+static msg_t loopback_gett(void *ip, systime_t time)
+{
+  return chIQGetTimeout(&((LoopbackChannel*) ip)->rx, time);
+}
+
+static size_t loopback_write(void *ip, const uint8_t *bp, size_t n)
+{
+  return loopback_writet(ip, bp, n, TIME_INFINITE);
+}
+
+static size_t loopback_read(void *ip, uint8_t *bp, size_t n)
+{
+  return loopback_readt(ip, bp, n, TIME_INFINITE);
+}
+
+static msg_t loopback_put(void *ip, uint8_t b)
+{
+  return loopback_putt(ip, b, TIME_INFINITE);
+}
+
+static msg_t loopback_get(void *ip)
+{
+  return loopback_gett(ip, TIME_INFINITE);
+}
+
+static const struct LoopbackChannelVMT loopback_vmt = {
+  loopback_write, loopback_read, loopback_put, loopback_get,
+  loopback_putt, loopback_gett, loopback_writet, loopback_readt
+};
+
+/*===========================================================================*/
+/* Fake host.                                                                */
+/*===========================================================================*/
+
+typedef struct {
+  LoopbackChannel channel;
+  FILE* fp;
+  BenchMode mode;
+  uint8_t window;
+  int32_t line_number;
+
+  /* Lines waiting for their "ok", oldest first */
+  systime_t sent_at[BENCH_MAX_WINDOW];
+  uint8_t outstanding;
+
+  char reply[BENCH_LINE_LENGTH];
+  uint8_t reply_length;
+
+  PrinterCommand command;
+  decode_context_t decode_context;
+
+  uint32_t lines;
+  uint32_t busy;
+  uint32_t resends;
+  uint32_t errors;
+  uint32_t latency[BENCH_LATENCY_BUCKETS + 1];
+
+  uint32_t fill_sum[BENCH_FILL_SECONDS];
+  uint16_t fill_count[BENCH_FILL_SECONDS];
+  uint8_t fill_max;
+} BenchHost;
+
+static void bench_send(BenchHost* b, const char* line)
+{
+  char buf[BENCH_LINE_LENGTH + 16];
+  int n;
+
+  if (b->mode == BENCH_Plain)
+  {
+    n = snprintf(buf, sizeof(buf), "%s\n", line);
+  } else {
+    n = snprintf(buf, sizeof(buf), "N%d %s", ++b->line_number, line);
+    if (b->mode == BENCH_Checksum)
+    {
+      uint8_t checksum = 0;
+      for (int i = 0; i < n; i++)
+        checksum ^= buf[i];
+      n += snprintf(buf + n, sizeof(buf) - n, "*%d", checksum);
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, "\n");
+  }
+
+  b->sent_at[b->outstanding++] = chTimeNow();
+  loopback_push(&b->channel.rx, (uint8_t*) buf, n);
+  chSysLock();
+  chnAddFlagsI(&b->channel, CHN_INPUT_AVAILABLE);
+  chSchRescheduleS();
+  chSysUnlock();
+}
+
+/* Reads the next line of the file, skipping the empty ones */
+static bool_t bench_next_line(BenchHost* b, char* line)
+{
+  while (fgets(line, BENCH_LINE_LENGTH, b->fp))
+  {
+    char* end = line + strlen(line);
+    while (end > line && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' '))
+      end--;
+    *end = '\0';
+    if (end > line)
+      return TRUE;
+  }
+  return FALSE;
+}
+
+/* Returns TRUE if the data host runs the line as a sync action */
+static bool_t bench_is_sync_action(BenchHost* b, const char* line)
+{
+  char buf[BENCH_LINE_LENGTH];
+  parse_context_t context = 0;
+  int n = gcodeFilterBlock(buf, sizeof(buf) - 1, line, strlen(line), &context);
+  if (n < 0)
+    return FALSE;
+  buf[n] = '\0';
+  return gcodeDecode(&b->command, buf, &b->decode_context) &&
+      (b->command.type & COMMANDTYPE_SyncAction) == COMMANDTYPE_SyncAction;
+}
+
+/* Returns TRUE once a complete reply line is in b->reply */
+static bool_t bench_receive(BenchHost* b, systime_t timeout)
+{
+  while (1)
+  {
+    msg_t c = chIQGetTimeout(&b->channel.tx, timeout);
+    if (c < 0)
+      return FALSE;
+    if (c == '\n')
+    {
+      b->reply[b->reply_length] = '\0';
+      b->reply_length = 0;
+      return TRUE;
+    }
+    if (b->reply_length < BENCH_LINE_LENGTH - 1)
+      b->reply[b->reply_length++] = c;
+  }
+}
+
+static void bench_complete_oldest(BenchHost* b)
+{
+  if (b->outstanding == 0)
+    return;
+  uint32_t latency = BENCH_ST2MS(chTimeNow() - b->sent_at[0]);
+  b->latency[latency < BENCH_LATENCY_BUCKETS ? latency : BENCH_LATENCY_BUCKETS]++;
+  b->outstanding--;
+  memmove(b->sent_at, b->sent_at + 1, b->outstanding * sizeof(systime_t));
+}
+
+static void bench_process_reply(BenchHost* b, const char* reply)
+{
+  if (strncmp(reply, "ok", 2) == 0)
+  {
+    b->lines++;
+    bench_complete_oldest(b);
+  } else if (strncmp(reply, "busy", 4) == 0)
+  {
+    // The line is dropped by the firmware, the run is no longer the file
+    b->busy++;
+  } else if (strncmp(reply, "rs", 2) == 0)
+  {
+    b->resends++;
+    bench_complete_oldest(b);
+  } else if (strncmp(reply, "!!", 2) == 0)
+  {
+    b->errors++;
+  }
+}
+
+static void bench_sample_fill(BenchHost* b, systime_t start)
+{
+  uint32_t second = BENCH_ST2MS(chTimeNow() - start) / 1000;
+  if (second >= BENCH_FILL_SECONDS)
+    return;
+  uint8_t length = plannerMainQueueGetLength();
+  b->fill_sum[second] += length;
+  b->fill_count[second]++;
+  if (length > b->fill_max)
+    b->fill_max = length;
+}
+
+static uint32_t bench_latency_percentile(BenchHost* b, uint32_t total, uint8_t percent)
+{
+  uint32_t target = (total * percent + 99) / 100;
+  uint32_t sum = 0;
+  for (uint32_t i = 0; i <= BENCH_LATENCY_BUCKETS; i++)
+  {
+    sum += b->latency[i];
+    if (sum >= target)
+      return i;
+  }
+  return BENCH_LATENCY_BUCKETS;
+}
+
+static void bench_report(BaseSequentialStream *chp, BenchHost* b, systime_t elapsed)
+{
+  uint32_t ms = BENCH_ST2MS(elapsed);
+  if (ms == 0) ms = 1;
+  uint32_t total = 0;
+  for (uint32_t i = 0; i <= BENCH_LATENCY_BUCKETS; i++)
+    total += b->latency[i];
+
+  chprintf(chp, "lines      : %u in %u ms, %u lines/s\r\n",
+      b->lines, ms, b->lines * 1000 / ms);
+  chprintf(chp, "resend     : %u, errors: %u\r\n", b->resends, b->errors);
+  if (total > 0)
+    chprintf(chp, "latency ms : p50 %u, p90 %u, p99 %u, max %u%s\r\n",
+        bench_latency_percentile(b, total, 50),
+        bench_latency_percentile(b, total, 90),
+        bench_latency_percentile(b, total, 99),
+        bench_latency_percentile(b, total, 100),
+        b->latency[BENCH_LATENCY_BUCKETS] ? "+" : "");
+  chprintf(chp, "queue fill : max %u/%u, per second:", b->fill_max, BLOCK_BUFFER_SIZE);
+  for (uint8_t i = 0; i < BENCH_FILL_SECONDS && b->fill_count[i]; i++)
+    chprintf(chp, " %u", b->fill_sum[i] / b->fill_count[i]);
+  chprintf(chp, "\r\n");
+}
+
+static void cmd_bench_host(BaseSequentialStream *chp, int argc, char *argv[])
+{
+  static BenchHost b;
+  char path[255];
+  char line[BENCH_LINE_LENGTH];
+
+  if (argc < 1 || argc > 3) {
+    chprintf(chp, "Usage: bench_host [filename] [window] [none|line|checksum]\r\n");
+    return;
+  }
+
+  memset(&b, 0, sizeof(b));
+  int window = argc > 1 ? atoi(argv[1]) : 1;
+  if (window < 1 || window > BENCH_MAX_WINDOW) {
+    chprintf(chp, "Window must be 1-%d\r\n", BENCH_MAX_WINDOW);
+    return;
+  }
+  b.window = window;
+  if (argc > 2)
+    b.mode = strcmp(argv[2], "checksum") == 0 ? BENCH_Checksum :
+             strcmp(argv[2], "line") == 0 ? BENCH_LineNumber : BENCH_Plain;
+
+  strcpy(path, "test/");
+  strncat(path, argv[0], 200);
+  b.fp = fopen(path, "r");
+  if (b.fp == NULL) {
+    chprintf(chp, "Failed to read the file %s\r\n", path);
+    return;
+  }
+
+  b.channel.vmt = &loopback_vmt;
+  chEvtInit(&b.channel.event);
+  chIQInit(&b.channel.rx, b.channel.rx_buffer, BENCH_BUFFER_SIZE, NULL, NULL);
+  chIQInit(&b.channel.tx, b.channel.tx_buffer, BENCH_BUFFER_SIZE, NULL, NULL);
+
+  dataHostSetDebugMirror(FALSE);
+  Thread* host = dataHostCreate((BaseAsynchronousChannel*) &b.channel);
+  chThdSleepMilliseconds(10);
+  chSysLock();
+  chnAddFlagsI(&b.channel, CHN_CONNECTED);
+  chSchRescheduleS();
+  chSysUnlock();
+  while (bench_receive(&b, BENCH_REPLY_TIMEOUT) && strcmp(b.reply, "start") != 0)
+    ;
+
+  if (b.mode != BENCH_Plain)
+  {
+    // Reset the line number of the connection
+    b.line_number = -1;
+    bench_send(&b, "M110");
+  }
+
+  systime_t start = chTimeNow();
+  systime_t last_sample = start;
+  bool_t eof = FALSE;
+  bool_t timeout = FALSE;
+  bool_t pending = FALSE;
+  bool_t pending_sync = FALSE;
+  while (!eof || pending || b.outstanding > 0)
+  {
+    while (b.outstanding < b.window)
+    {
+      if (!pending)
+      {
+        if (!bench_next_line(&b, line))
+        {
+          eof = TRUE;
+          break;
+        }
+        pending = TRUE;
+        pending_sync = bench_is_sync_action(&b, line);
+      }
+      if (pending_sync && b.outstanding > 0)
+        break;
+      bench_send(&b, line);
+      pending = FALSE;
+    }
+    if (b.outstanding == 0)
+      continue;
+    if (!bench_receive(&b, BENCH_REPLY_TIMEOUT))
+    {
+      timeout = TRUE;
+      break;
+    }
+    bench_process_reply(&b, b.reply);
+    if (b.busy)
+      break;
+    if (chTimeNow() - last_sample >= MS2ST(100))
+    {
+      bench_sample_fill(&b, start);
+      last_sample = chTimeNow();
+    }
+  }
+  systime_t elapsed = chTimeNow() - start;
+
+  fclose(b.fp);
+  chThdTerminate(host);
+  chThdWait(host);
+  dataHostSetDebugMirror(TRUE);
+
+  if (b.busy)
+  {
+    chprintf(chp, "Aborted, the data host dropped a line as busy\r\n");
+    return;
+  }
+  if (timeout)
+    chprintf(chp, "Timed out waiting for a reply, %u lines outstanding\r\n", b.outstanding);
+  bench_report(chp, &b, elapsed);
+}
+
+#endif
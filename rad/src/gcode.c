@@ -28,6 +28,45 @@ char gcodeFilterCharacter(char c, parse_context_t* context)
   return c;
 }
 
+int gcodeFilterBlock(char* dst, size_t size, const char* src, size_t len, parse_context_t* context)
+{
+  const char* end = src + len;
+  char* out = dst;
+
+  while (src < end)
+  {
+    if (*context == 0)
+    {
+      // Find the run of plain code up to the next comment marker,
+      // then copy it upper-cased in one go.
+      const char* run = src;
+      while (run < end && *run != '(' && *run != ';')
+        run++;
+      if ((size_t)(run - src) > size - (out - dst))
+        return -1;
+      for (; src < run; src++)
+      {
+        char c = *src;
+        *(out++) = (c >= 'a' && c <= 'z') ? c - ('a' - 'A') : c;
+      }
+      if (src == end)
+        break;
+      *context = *(src++) == '(' ? 1 : 2;
+    } else if (*context == 1)
+    {
+      const char* close = memchr(src, ')', end - src);
+      if (close == NULL)
+        break;
+      *context = 0;
+      src = close + 1;
+    } else {
+      // The rest of the line is comment
+      break;
+    }
+  }
+  return out - dst;
+}
+
 
 static bool_t code_seen(char* start, char code, decode_context_t* context)
 {
@@ -53,6 +92,174 @@ static float code_value(decode_context_t* context)
   return val;
 }
 
+typedef struct {
+  char letter;
+  uint16_t number;
+  CommandType type;
+  uint8_t params;
+  bool_t (*decode)(PrinterCommand* cmd, uint16_t number);
+} GcodeDefinition;
+
+static const GcodeDefinition definitions[GCODE_Count];
+
+static void set_code(PrinterCommand* cmd, GcodeId id)
+{
+  cmd->code = id;
+}
+
+/*===========================================================================*/
+/* Modal words.                                                              */
+/*===========================================================================*/
+
+static bool_t decode_rapid(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->printer.rapid) return FALSE;
+  cmd->printer.rapid = number == 0 ? RAPIDMODE_Rapid : RAPIDMODE_Feed;
+  return TRUE;
+}
+
+static bool_t decode_unit(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->printer.unit) return FALSE;
+  cmd->printer.unit = number == 21 ? UNITMODE_Millimeter : UNITMODE_Inch;
+  return TRUE;
+}
+
+static bool_t decode_distance(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->printer.distance) return FALSE;
+  cmd->printer.distance = number == 90 ? DISTANCEMODE_Absolute : DISTANCEMODE_Relative;
+  return TRUE;
+}
+
+static bool_t decode_extruder_distance(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->printer.extruder_distance) return FALSE;
+  cmd->printer.extruder_distance = number == 82 ? DISTANCEMODE_Absolute : DISTANCEMODE_Relative;
+  return TRUE;
+}
+
+static bool_t decode_power(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->power) return FALSE;
+  switch (number) {
+  case 81: case 0: cmd->power = POWERMODE_Off; break;
+  case 2: case 1: cmd->power = POWERMODE_Sleep; break;
+  case 80: case 17: cmd->power = POWERMODE_On; break;
+  case 84: case 18: cmd->power = POWERMODE_Idle; break;
+  }
+  return TRUE;
+}
+
+static bool_t decode_wait(PrinterCommand* cmd, uint16_t number)
+{
+  if (cmd->wait) return FALSE;
+  switch (number) {
+  case 116: // Wait all temps
+    cmd->wait = WAITMODE_All;
+    break;
+  case 109: // Set current tool temp and wait
+    if (cmd->code) return FALSE;
+    set_code(cmd, GCODE_M104);
+    cmd->wait = WAITMODE_CurrentTool;
+    break;
+  case 190: // Set bed temp and wait
+    if (cmd->code) return FALSE;
+    set_code(cmd, GCODE_M140);
+    cmd->wait = WAITMODE_HeatedBed;
+    break;
+  }
+  return TRUE;
+}
+
+/*===========================================================================*/
+/* Code table.                                                               */
+/*===========================================================================*/
+
+#define DEFINITION_ENTRY(id, letter, number, type, params, decode, dispatch) \
+  [GCODE_##id] = { letter, number, type, params, decode },
+
+static const GcodeDefinition definitions[GCODE_Count] = {
+  GCODE_TABLE(DEFINITION_ENTRY)
+  [GCODE_Unknown] = { 0, 0, COMMANDTYPE_UnknownCode, GCODEPARAM_None, NULL }
+};
+
+#define LOOKUP_KEY(letter, number) (((uint32_t) (letter) << 16) | (number))
+#define LOOKUP_ENTRY(id, letter, number, type, params, decode, dispatch) \
+  case LOOKUP_KEY(letter, number): return GCODE_##id;
+
+/*
+ * A switch over the table, the compiler turns it into a jump table or a
+ * binary search. Listing a code twice fails to compile.
+ */
+static GcodeId lookup_code(char letter, uint16_t number)
+{
+  switch (LOOKUP_KEY(letter, number))
+  {
+  GCODE_TABLE(LOOKUP_ENTRY)
+  }
+  return GCODE_Unknown;
+}
+
+/*
+ * Apply one G/M word to the command.
+ * Returns the definition of the code, or NULL if the command is invalid.
+ */
+static const GcodeDefinition* decode_code(PrinterCommand* cmd, char letter, int value)
+{
+  GcodeId id = (value < 0 || value > 0xFFFF) ? GCODE_Unknown : lookup_code(letter, value);
+  const GcodeDefinition* def = &definitions[id];
+
+  if ((def->params & GCODEPARAM_S) && isnan(cmd->s_value)) return NULL;
+  if ((def->params & GCODEPARAM_P) && cmd->p_value < 0) return NULL;
+  if ((def->type & COMMANDTYPE_CanHaveAxisWords) &&
+      (cmd->type & COMMANDTYPE_CanHaveAxisWords)) return NULL;
+
+  GcodeId code = cmd->code;
+  if (def->decode)
+  {
+    if (!def->decode(cmd, value)) return NULL;
+  } else {
+    if (cmd->code) return NULL;
+    set_code(cmd, id);
+  }
+  // Keep the word as received for the host, the one that set the code
+  // wins over modal words
+  if (!cmd->code_letter || cmd->code != code)
+  {
+    cmd->code_letter = letter;
+    cmd->code_number = value;
+  }
+  cmd->type |= def->type;
+  return def;
+}
+
+/*
+ * Cuts a string argument, e.g. the file name of M28, off the line so its
+ * letters are not read as words. Returns the argument or NULL.
+ */
+static char* split_string_argument(char* buf)
+{
+  for (char* m = strchr(buf, 'M'); m != NULL; m = strchr(m + 1, 'M'))
+  {
+    char* end;
+    long number = strtol(m + 1, &end, 10);
+    if (end == m + 1 || number < 0 || number > 0xFFFF)
+      continue;
+    if (!(definitions[lookup_code('M', number)].params & GCODEPARAM_String))
+      continue;
+    if (*end == '\0')
+      return end;
+    if (*end != ' ')
+      continue;
+    *end++ = '\0';
+    while (*end == ' ')
+      end++;
+    return end;
+  }
+  return NULL;
+}
+
 void gcodeInitializeCommand(PrinterCommand* cmd)
 {
   memset(cmd, 0, sizeof(PrinterCommand));
@@ -72,7 +279,7 @@ void gcodeInitializeCommand(PrinterCommand* cmd)
 bool_t gcodeDecode(PrinterCommand* cmd, char* buf, decode_context_t* decode_context)
 {
   gcodeInitializeCommand(cmd);
-  int value;
+  cmd->string_value = split_string_argument(buf);
 
   if (code_seen(buf, 'N', decode_context))
     cmd->line = (int32_t) code_value(decode_context);
@@ -118,149 +325,95 @@ bool_t gcodeDecode(PrinterCommand* cmd, char* buf, decode_context_t* decode_cont
 
   if (code_seen(buf, 'M', decode_context))
     do {
-      switch (value = (int) code_value(decode_context)) {
-        /* Power */
-        case 80: // ATX On
-        case 81: // ATX Off
-        case 84: // Motor Idle
-        case 0: // Stop
-        case 1: // Sleep
-        case 2: // End program
-        case 17: // Stepper On
-        case 18: // Stepper Off
-          if (cmd->power) return FALSE;
-          switch (value) {
-          case 81: case 0: value = POWERMODE_Off; break;
-          case 2: case 1: value = POWERMODE_Sleep; break;
-          case 80: case 17: value = POWERMODE_On; break;
-          case 84: case 18: value = POWERMODE_Idle; break;
-          }
-          cmd->type |= COMMANDTYPE_SyncAction;
-          break;
-
-        /* Distance */
-        case 82: // Extruder distance
-        case 83:
-          if (cmd->printer.extruder_distance) return FALSE;
-          cmd->printer.extruder_distance = value == 82 ? DISTANCEMODE_Absolute : DISTANCEMODE_Relative;
-          cmd->type |= COMMANDTYPE_SyncAction;
-          break;
-
-        /* Wait */
-        case 116: // Wait all temps
-          if (cmd->wait) return FALSE;
-          cmd->wait = WAITMODE_All;
-          cmd->type |= COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart;
-          break;
-        case 109: // Set current tool temp and wait
-          if (cmd->wait) return FALSE;
-          if (!isnan(cmd->s_value)) {
-            if (cmd->code) return FALSE;
-            cmd->code = 10104;
-          }
-          cmd->wait = WAITMODE_CurrentTool;
-          cmd->type |= COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart;
-          break;
-        case 190: // Set bed temp and wait
-          if (cmd->wait) return FALSE;
-          if (!isnan(cmd->s_value)) {
-            if (cmd->code) return FALSE;
-            cmd->code = 10140;
-          }
-          cmd->wait = WAITMODE_HeatedBed;
-          cmd->type |= COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart;
-          break;
-
-        /* Code with immediate effect, handled in the fetcher */
-        case 105: // Get temp report
-        case 112: // Estop
-        case 114: // Get position
-        case 115: // Capabilities
-        case 111: // Debug capabilities (Ignored for now)
-        case 999: // Clear Estop
-          if (cmd->code) return FALSE;
-          cmd->code = value + 10000;
-          break;
-
-        /* Code that is conflict with everything else */
-        case 104: // Set current tool temp
-        case 140: // Set bed temp
-        case 110: // Line number - flush the printer queue
-        case 106: // Fan speed
-        case 220: // Set feedrate multiplier (speed factor override)
-        case 221: // Set flow multiplier (extrude factor override)
-          if (cmd->code) return FALSE;
-          cmd->code = value + 10000;
-          // All of the above are not sync action incidentally
-          cmd->type |= COMMANDTYPE_Action;
-          break;
-        default:
-          if (cmd->code) return FALSE;
-          cmd->code = value + 10000;
-          cmd->type |= COMMANDTYPE_UnknownCode;
-          break;
-      }
-      switch (value) {
-        case 104: // Set current tool temp
-        case 106: // Fan speed
-        case 109: // Set current tool temp and wait
-        case 140: // Set bed temp
-        case 190: // Set bed temp and wait
-        case 220: // Set feedrate multiplier (speed factor override)
-        case 221: // Set flow multiplier (extrude factor override)
-          if (isnan(cmd->s_value)) return FALSE;
-          break;
-        case 28:
-          return TRUE;
-      }
+      const GcodeDefinition* def = decode_code(cmd, 'M', (int) code_value(decode_context));
+      if (def == NULL) return FALSE;
+      if (def->params & GCODEPARAM_String) return TRUE;
     } while (code_seen_next(decode_context));
 
   if (code_seen(buf, 'G', decode_context))
     do {
-      switch (value = (int) code_value(decode_context)) {
-        case 20: // mm
-        case 21: // inch
-          if (cmd->printer.unit) return FALSE;
-          cmd->printer.unit = value == 21 ? UNITMODE_Millimeter : UNITMODE_Inch;
-          break;
-        case 90: // Absolute
-        case 91: // Relative
-          if (cmd->printer.distance) return FALSE;
-          cmd->printer.distance = value == 90 ? DISTANCEMODE_Absolute : DISTANCEMODE_Relative;
-          break;
-        case 4: // DWell
-          if (cmd->code) return FALSE;
-          if (isnan(cmd->p_value)) return FALSE;
-          cmd->code = value;
-          break;
-        case 10: // Offset (Head configuration)
-          if (cmd->code) return FALSE;
-          if (isnan(cmd->p_value)) return FALSE;
-          if (cmd->type & COMMANDTYPE_CanHaveAxisWords) return FALSE;
-          cmd->type |= COMMANDTYPE_CanHaveAxisWords;
-          cmd->code = value;
-          break;
-        case 0: // Motion (We treat G0 as G1)
-        case 1:
-          if (cmd->printer.rapid) return FALSE;
-          if (cmd->type & COMMANDTYPE_CanHaveAxisWords) return FALSE;
-          cmd->printer.rapid = value == 0 ? RAPIDMODE_Rapid : RAPIDMODE_Feed;
-          cmd->type |= COMMANDTYPE_Movement;
-          break;
-        case 28: // Homing
-        case 92: // Set Position
-          if (cmd->code) return FALSE;
-          if (cmd->type & COMMANDTYPE_CanHaveAxisWords) return FALSE;
-          cmd->type |= COMMANDTYPE_CanHaveAxisWords;
-          cmd->code = value;
-          break;
-        default:
-          if (cmd->code) return FALSE;
-          cmd->code = value;
-          cmd->type |= COMMANDTYPE_UnknownCode;
-      }
-      if (!(cmd->type & COMMANDTYPE_UnknownCode))
-        cmd->type |= COMMANDTYPE_SyncAction;
+      const GcodeDefinition* def = decode_code(cmd, 'G', (int) code_value(decode_context));
+      if (def == NULL) return FALSE;
     } while (code_seen_next(decode_context));
   return TRUE;
 }
+
+/*
+ * Decodes one record of a pre-compiled print file, see gcode_binary.h.
+ * The record must be complete, GCODEBIN_RECORD_SIZE bytes.
+ */
+bool_t gcodeDecodeBinary(PrinterCommand* cmd, const uint8_t* record)
+{
+  gcodeInitializeCommand(cmd);
+
+  uint16_t words = GCODEBIN_U16(record);
+  uint8_t codes = record[4];
+  if ((words & ~GCODEBIN_WORD_ALL) || codes > GCODEBIN_MAX_CODES)
+    return FALSE;
+
+  const uint8_t* code = record + GCODEBIN_RECORD_HEADER_SIZE;
+  const uint8_t* ptr = code + 3 * codes;
+  int32_t values[GCODEBIN_WORD_COUNT];
+  for (uint8_t i = 0; i < GCODEBIN_WORD_COUNT; i++)
+  {
+    if (words & (1 << i)) {
+      values[i] = (int32_t) GCODEBIN_U32(ptr);
+      ptr += 4;
+    }
+  }
+#define WORD_VALUE(word) values[__builtin_ctz(word)]
+#define WORD_SCALED(word) ((float) WORD_VALUE(word) / GCODEBIN_SCALE)
+
+  if (words & GCODEBIN_WORD_N)
+    cmd->line = WORD_VALUE(GCODEBIN_WORD_N);
+  if (words & GCODEBIN_WORD_R)
+    cmd->r_value = WORD_SCALED(GCODEBIN_WORD_R);
+  if (words & GCODEBIN_WORD_S)
+    cmd->s_value = WORD_SCALED(GCODEBIN_WORD_S);
+  if (words & GCODEBIN_WORD_P)
+    cmd->p_value = WORD_VALUE(GCODEBIN_WORD_P);
+
+  if (words & GCODEBIN_WORD_F)
+  {
+    cmd->printer.feedrate = WORD_SCALED(GCODEBIN_WORD_F);
+    if (cmd->printer.feedrate < 1)
+      return FALSE;
+    cmd->type |= COMMANDTYPE_SyncAction;
+  }
+
+  if (words & GCODEBIN_WORD_E) {
+    cmd->e_value = WORD_SCALED(GCODEBIN_WORD_E);
+    cmd->type |= COMMANDTYPE_SyncAction;
+  }
+
+  for (uint8_t i = 0; i < RAD_NUMBER_AXES; i++)
+  {
+    const char* letter = strchr(GCODEBIN_WORD_LETTERS + GCODEBIN_WORD_AXIS_FIRST,
+        machine.kinematics.axes[i].name);
+    if (letter == NULL)
+      continue;
+    uint16_t word = 1 << (letter - GCODEBIN_WORD_LETTERS);
+    if (words & word) {
+      cmd->axes_value[i] = WORD_SCALED(word);
+      cmd->type |= COMMANDTYPE_SyncAction;
+    }
+  }
+
+  if (words & GCODEBIN_WORD_T) {
+    int32_t tool = WORD_VALUE(GCODEBIN_WORD_T);
+    if (tool < 0 || tool >= RAD_NUMBER_EXTRUDERS)
+      return FALSE;
+    cmd->t_value = (int8_t) tool;
+    cmd->type |= COMMANDTYPE_SyncAction;
+  }
+#undef WORD_SCALED
+#undef WORD_VALUE
+
+  for (uint8_t i = 0; i < codes; i++, code += 3)
+  {
+    const GcodeDefinition* def = decode_code(cmd, (char) code[0], GCODEBIN_U16(code + 1));
+    if (def == NULL) return FALSE;
+    if (def->params & GCODEPARAM_String) return TRUE;
+  }
+  return TRUE;
+}
@@ -21,6 +21,8 @@
 #ifndef _GCODE_DECODE_H_
 #define _GCODE_DECODE_H_
 
+#include "gcode_binary.h"
+
 typedef uint8_t parse_context_t;
 typedef char* decode_context_t;
 
@@ -31,7 +33,9 @@ extern "C" {
   void gcodeResetParseContext(parse_context_t* context);
   void gcodeInitializeCommand(PrinterCommand* cmd);
   char gcodeFilterCharacter(char c, parse_context_t* context);
+  int gcodeFilterBlock(char* dst, size_t size, const char* src, size_t len, parse_context_t* context);
   bool_t gcodeDecode(PrinterCommand* cmd, char* buf, decode_context_t* decode_context);
+  bool_t gcodeDecodeBinary(PrinterCommand* cmd, const uint8_t* record);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,123 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Pre-compiled print file
+ *
+ * Made from a G-code file on the host by tools/gcode2radb, so SD prints
+ * skip comment filtering and number parsing. Shared with the host tool,
+ * keep it free of firmware headers. All values are little-endian.
+ *
+ * File:    header | records | index | layers
+ *
+ * Header:  char[4] magic
+ *          u16     version
+ *          u16     reserved
+ *          u32     record count
+ *          u32     offset of the index, where the records end
+ *          u32     index entry count
+ *          u32     source line count
+ *          u32     layer count
+ *
+ * Record:  u16     GCODEBIN_WORD_* present in the record
+ *          u16     source lines since the previous record
+ *          u8      number of G/M words
+ *          G/M words, u8 letter and u16 number each, M words first
+ *          i32 for each present word in bit order. Scaled words are
+ *              fixed point with GCODEBIN_SCALE, the rest are integers.
+ *
+ * Index:   u32 record offset and u32 source line, one entry for every
+ *          GCODEBIN_INDEX_INTERVAL records
+ *
+ * Layers:  one GCODEBIN_LAYER_SIZE entry per layer
+ *          u32     offset of the record that moved to the layer height
+ *          u32     source line before that record, the record adds its
+ *                  own line count when read as from the top
+ *          i32     layer height, scaled
+ *          i32     extruder position before the layer, scaled, or
+ *                  GCODEBIN_NO_E with relative extrusion
+ *          u32     GCODEBIN_MODE_* in effect before that record
+ *          i32     last F before that record, scaled, or 0 if none
+ *
+ * A layer starts with the first extruding move above the height of the
+ * previous layer, so Z hops and travel moves do not count.
+ *
+ * G/M words are kept as written and classified with the printer code
+ * table when read, so files stay valid when the table changes.
+ */
+
+#ifndef _GCODE_BINARY_H_
+#define _GCODE_BINARY_H_
+
+#include <stdint.h>
+
+#define GCODEBIN_MAGIC "RADB"
+#define GCODEBIN_VERSION 4
+#define GCODEBIN_HEADER_SIZE 28
+#define GCODEBIN_LAYER_SIZE 24
+#define GCODEBIN_NO_E INT32_MIN
+
+#define GCODEBIN_SCALE 1000
+#define GCODEBIN_MAX_CODES 4
+#define GCODEBIN_INDEX_INTERVAL 256
+
+/* Word letters in bit order, axes last */
+#define GCODEBIN_WORD_LETTERS "NRSPFETXYZABC"
+#define GCODEBIN_WORD_COUNT 13
+#define GCODEBIN_WORD_AXIS_FIRST 7
+
+typedef enum {
+  GCODEBIN_WORD_N = 0x0001,
+  GCODEBIN_WORD_R = 0x0002,
+  GCODEBIN_WORD_S = 0x0004,
+  GCODEBIN_WORD_P = 0x0008,
+  GCODEBIN_WORD_F = 0x0010,
+  GCODEBIN_WORD_E = 0x0020,
+  GCODEBIN_WORD_T = 0x0040,
+  /* One bit per axis letter from here */
+  GCODEBIN_WORD_AXIS = 0x0080
+} GcodeBinWord;
+
+/* Modal state of a layer entry, so printing can start from the layer */
+typedef enum {
+  GCODEBIN_MODE_RELATIVE = 0x01,    /* G91, G90 otherwise */
+  GCODEBIN_MODE_RELATIVE_E = 0x02,  /* M83, M82 otherwise */
+  GCODEBIN_MODE_INCHES = 0x04       /* G20, G21 otherwise */
+} GcodeBinMode;
+
+#define GCODEBIN_WORD_ALL ((1 << GCODEBIN_WORD_COUNT) - 1)
+#define GCODEBIN_WORD_AXES (GCODEBIN_WORD_ALL & ~(GCODEBIN_WORD_AXIS - 1))
+#define GCODEBIN_WORD_INTEGER (GCODEBIN_WORD_N | GCODEBIN_WORD_P | GCODEBIN_WORD_T)
+
+#define GCODEBIN_RECORD_HEADER_SIZE 5
+#define GCODEBIN_RECORD_MAX_SIZE \
+  (GCODEBIN_RECORD_HEADER_SIZE + 3 * GCODEBIN_MAX_CODES + 4 * GCODEBIN_WORD_COUNT)
+
+#define GCODEBIN_U16(p) \
+  ((uint16_t) ((uint8_t) (p)[0] | ((uint8_t) (p)[1] << 8)))
+#define GCODEBIN_U32(p) \
+  ((uint32_t) GCODEBIN_U16(p) | ((uint32_t) GCODEBIN_U16((p) + 2) << 16))
+
+/* Size of a record from its first GCODEBIN_RECORD_HEADER_SIZE bytes */
+#define GCODEBIN_RECORD_SIZE(p) \
+  (GCODEBIN_RECORD_HEADER_SIZE + 3 * (uint8_t) (p)[4] + \
+   4 * __builtin_popcount(GCODEBIN_U16(p)))
+
+#endif
@@ -72,6 +72,88 @@ typedef enum {
   COMMANDTYPE_PrinterResume = 0x2000
 } CommandType;
 
+typedef enum {
+  GCODEPARAM_None = 0,
+  GCODEPARAM_S = 0x01,
+  GCODEPARAM_P = 0x02,
+  /** The rest of the line is a string argument, decoding stops here **/
+  GCODEPARAM_String = 0x80
+} GcodeParam;
+
+/*
+ * G/M code table
+ *
+ * X(id, letter, number, type, params, decode, dispatch)
+ *   type     - COMMANDTYPE_* flags the code adds to the command
+ *   params   - GCODEPARAM_* words required by the code
+ *   decode   - Modal word handler in gcode.c. Codes with a decode handler
+ *              do not take the command code slot. NULL otherwise.
+ *   dispatch - Handler run by the printer thread, NULL if none
+ *
+ * Codes without COMMANDTYPE_Action are handled by the data source
+ * (host or storage) as soon as they are received.
+ */
+#define GCODE_TABLE(X) \
+  /* Motion */ \
+  X(G0,    'G',    0, COMMANDTYPE_SyncAction | COMMANDTYPE_Movement, GCODEPARAM_None, decode_rapid, NULL) \
+  X(G1,    'G',    1, COMMANDTYPE_SyncAction | COMMANDTYPE_Movement, GCODEPARAM_None, decode_rapid, NULL) \
+  X(G4,    'G',    4, COMMANDTYPE_SyncAction, GCODEPARAM_P, NULL, dispatch_dwell) \
+  X(G10,   'G',   10, COMMANDTYPE_SyncAction | COMMANDTYPE_CanHaveAxisWords, GCODEPARAM_P, NULL, NULL) \
+  X(G20,   'G',   20, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_unit, NULL) \
+  X(G21,   'G',   21, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_unit, NULL) \
+  X(G28,   'G',   28, COMMANDTYPE_SyncAction | COMMANDTYPE_CanHaveAxisWords, GCODEPARAM_None, NULL, dispatch_homing) \
+  X(G90,   'G',   90, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_distance, NULL) \
+  X(G91,   'G',   91, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_distance, NULL) \
+  X(G92,   'G',   92, COMMANDTYPE_SyncAction | COMMANDTYPE_CanHaveAxisWords, GCODEPARAM_None, NULL, dispatch_set_position) \
+  /* Power */ \
+  X(M0,    'M',    0, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M1,    'M',    1, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M2,    'M',    2, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M17,   'M',   17, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M18,   'M',   18, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M80,   'M',   80, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M81,   'M',   81, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  X(M84,   'M',   84, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_power, NULL) \
+  /* Extruder distance */ \
+  X(M82,   'M',   82, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_extruder_distance, NULL) \
+  X(M83,   'M',   83, COMMANDTYPE_SyncAction, GCODEPARAM_None, decode_extruder_distance, NULL) \
+  /* Temperature */ \
+  X(M104,  'M',  104, COMMANDTYPE_Action, GCODEPARAM_S, NULL, dispatch_set_tool_temp) \
+  X(M109,  'M',  109, COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart, GCODEPARAM_S, decode_wait, NULL) \
+  X(M116,  'M',  116, COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart, GCODEPARAM_None, decode_wait, NULL) \
+  X(M140,  'M',  140, COMMANDTYPE_Action, GCODEPARAM_S, NULL, dispatch_set_bed_temp) \
+  X(M190,  'M',  190, COMMANDTYPE_SyncAction | COMMANDTYPE_TimeStart, GCODEPARAM_S, decode_wait, NULL) \
+  X(M303,  'M',  303, COMMANDTYPE_SyncAction, GCODEPARAM_S, NULL, dispatch_autotune) \
+  /* Progress */ \
+  X(M73,   'M',   73, COMMANDTYPE_Action, GCODEPARAM_None, NULL, dispatch_print_progress) \
+  /* Overrides */ \
+  X(M106,  'M',  106, COMMANDTYPE_Action, GCODEPARAM_S, NULL, dispatch_fan_speed) \
+  X(M220,  'M',  220, COMMANDTYPE_Action, GCODEPARAM_S, NULL, dispatch_feedrate_multiplier) \
+  X(M221,  'M',  221, COMMANDTYPE_Action, GCODEPARAM_S, NULL, dispatch_flow_multiplier) \
+  /* Host */ \
+  X(M27,   'M',   27, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M28,   'M',   28, COMMANDTYPE_None, GCODEPARAM_String, NULL, NULL) \
+  X(M29,   'M',   29, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M105,  'M',  105, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M110,  'M',  110, COMMANDTYPE_Action, GCODEPARAM_None, NULL, NULL) \
+  X(M111,  'M',  111, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M112,  'M',  112, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M114,  'M',  114, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M115,  'M',  115, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M500,  'M',  500, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M999,  'M',  999, COMMANDTYPE_None, GCODEPARAM_None, NULL, NULL) \
+  X(M1105, 'M', 1105, COMMANDTYPE_None, GCODEPARAM_S, NULL, NULL) \
+  X(M1106, 'M', 1106, COMMANDTYPE_None, GCODEPARAM_S, NULL, NULL)
+
+typedef enum {
+  GCODE_None = 0,
+#define GCODE_ENUM(id, letter, number, type, params, decode, dispatch) GCODE_##id,
+  GCODE_TABLE(GCODE_ENUM)
+#undef GCODE_ENUM
+  GCODE_Unknown,
+  GCODE_Count
+} GcodeId;
+
 /** Printer command **/
 typedef struct {
   PrinterMode printer;
@@ -81,7 +163,10 @@ typedef struct {
   CommandType type;
 
   /** G or M code **/
-  uint16_t code;
+  GcodeId code;
+  /** Code as received, e.g. 'M' and 104 **/
+  char code_letter;
+  uint16_t code_number;
 
   /** Line number **/
   int32_t line;
@@ -101,6 +186,9 @@ typedef struct {
   /** Motion parameter: Axes **/
   float axes_value[RAD_NUMBER_AXES];
 
+  /** String argument, see GCODEPARAM_String. Points into the decoded line **/
+  char* string_value;
+
   Mailbox* ack_mbox;
   EventSource* ack_evt;
 } PrinterCommand;
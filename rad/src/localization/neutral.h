@@ -109,6 +109,31 @@
   "E21-Autotune timeout"
 #endif
 
+#ifndef L_TEMPERATURE_AUTOTUNE_REFUSED
+#define L_TEMPERATURE_AUTOTUNE_REFUSED \
+  "E22-Cannot start autotune"
+#endif
+
+#ifndef L_TEMPERATURE_SENSOR_FAULT
+#define L_TEMPERATURE_SENSOR_FAULT \
+  "E23-Temperature %d sensor fault"
+#endif
+
+#ifndef L_TEMPERATURE_OVERHEATED
+#define L_TEMPERATURE_OVERHEATED \
+  "E24-Temperature %d too hot"
+#endif
+
+#ifndef L_TEMPERATURE_NOT_HEATING
+#define L_TEMPERATURE_NOT_HEATING \
+  "E25-Temperature %d not heating"
+#endif
+
+#ifndef L_TEMPERATURE_RUNAWAY
+#define L_TEMPERATURE_RUNAWAY \
+  "E26-Temperature %d thermal runaway"
+#endif
+
 #ifndef L_STORAGE_NOT_IN_STANDBY
 #define L_STORAGE_NOT_IN_STANDBY \
   "E30-Cannot start SD print in non-standby mode"
@@ -129,6 +154,16 @@
   "E33-Invalid Gcode at line %d"
 #endif
 
+#ifndef L_STORAGE_FILE_FORMAT_ERROR
+#define L_STORAGE_FILE_FORMAT_ERROR \
+  "E34-Unsupported print file at line %d"
+#endif
+
+#ifndef L_STORAGE_LAYER_ERROR
+#define L_STORAGE_LAYER_ERROR \
+  "E35-Cannot start at layer %d"
+#endif
+
 #ifndef L_PRINTER_HOST_GCODE_ERROR
 #define L_PRINTER_HOST_GCODE_ERROR \
   "E50-Invalid Gcode from host"
@@ -37,7 +37,7 @@ static RadTemp temps[] = {
     .heating_pwm_id = RADBOARD_EXTRUDER_1_OUTPUT,
     .cooling_pwm_id = -1,
     .converter = adccType1,
-    .config = { .Kp=2.8, .Ki=0.55, .Kd=3.53 }
+    .config = { .Kp=2.8, .Ki=11, .Kd=0.18 }
   },
 #endif
 #if defined(RADBOARD_EXTRUDER_2_TEMP_ADC) && RAD_NUMBER_EXTRUDERS >= 2
@@ -46,7 +46,7 @@ static RadTemp temps[] = {
     .heating_pwm_id = RADBOARD_EXTRUDER_2_OUTPUT,
     .cooling_pwm_id = -1,
     .converter = adccType1,
-    .config = { .Kp=2.8, .Ki=0.55, .Kd=3.53 }
+    .config = { .Kp=2.8, .Ki=11, .Kd=0.18 }
   },
 #endif
 #if defined(RADBOARD_EXTRUDER_3_TEMP_ADC) && RAD_NUMBER_EXTRUDERS >= 3
@@ -55,7 +55,7 @@ static RadTemp temps[] = {
     .heating_pwm_id = RADBOARD_EXTRUDER_3_OUTPUT,
     .cooling_pwm_id = -1,
     .converter = adccBedConverter,
-    .config = { .Kp=2.8, .Ki=0.55, .Kd=3.53 }
+    .config = { .Kp=2.8, .Ki=11, .Kd=0.18 }
   },
 #endif
 #ifdef RADBOARD_BED_TEMP_ADC
@@ -63,8 +63,10 @@ static RadTemp temps[] = {
     .adc_id = RADBOARD_BED_TEMP_ADC,
     .heating_pwm_id = RADBOARD_BED_OUTPUT,
     .cooling_pwm_id = -1,
+    .control_interval = MS2ST(500),
     .converter = adccBedConverter,
-    .config = { .Kp=2.8, .Ki=0.55, .Kd=3.53 }
+    .config = { .Kp=2.8, .Ki=11, .Kd=0.18 },
+    .guard = { .max_temp = 150, .heating_period = S2ST(60) }
   },
 #endif
 #ifdef RADBOARD_SYSTEM_TEMP_ADC
@@ -192,6 +194,14 @@ const machine_t machine =
         }
         */
     },
+    .slow_output = {
+        .count = 0,
+        /* A bed on an SSR
+        .devices = (RadSlowOutput[]) {
+          { .pwm_id = RADBOARD_BED_OUTPUT, .period = S2ST(2) }
+        }
+        */
+    },
     .ui = {
         .contrast = 0.5,
         .generic_wheel = { .enabled = 1, .input_id = 0 },
@@ -34,10 +34,56 @@
 
 #if HAL_USE_PWM
 /*===========================================================================*/
-/* Exported functions.                                                       */
+/* Local variables and types.                                                */
 /*===========================================================================*/
 
+/*
+ * Slow outputs switch on this tick. One 50Hz mains cycle, zero crossing
+ * SSRs round it to the next crossing on 60Hz.
+ */
+#ifndef OUTPUT_SLOW_TICK
+#define OUTPUT_SLOW_TICK MS2ST(20)
+#endif
+
+typedef struct {
+  uint16_t  period;   /* in ticks, 0 for the hardware PWM */
+  uint16_t  phase;
+  uint16_t  on;
+} OutputSlowState;
+
 static uint8_t outputs[RAD_NUMBER_OUTPUTS];
+static OutputSlowState slow[RAD_NUMBER_OUTPUTS];
+static VirtualTimer slow_vt;
+static uint32_t slow_ticks;
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+/*
+ * Switches all slow outputs from a single timer, each on for the first
+ * part of its period.
+ */
+static void output_slow_tick(void *arg)
+{
+  (void) arg;
+  chVTSetI(&slow_vt, OUTPUT_SLOW_TICK, output_slow_tick, NULL);
+  slow_ticks++;
+  for (uint8_t i = 0; i < RAD_NUMBER_OUTPUTS; i++)
+  {
+    OutputSlowState *st = &slow[i];
+    if (st->period == 0)
+      continue;
+    if ((slow_ticks + st->phase) % st->period < st->on)
+      palEnableSig(radboard.output.channels[i].signal);
+    else
+      palDisableSig(radboard.output.channels[i].signal);
+  }
+}
+
+/*===========================================================================*/
+/* Exported functions.                                                       */
+/*===========================================================================*/
 
 void outputInit()
 {
@@ -49,12 +95,35 @@ void outputInit()
     pexDisableSig(ch->signal);
     palSetSigMode(ch->signal, PAL_MODE_OUTPUT_PUSHPULL);
   }
+
+  if (machine.slow_output.count == 0)
+    return;
+  for (i = 0; i < machine.slow_output.count; i++)
+  {
+    RadSlowOutput *so = &machine.slow_output.devices[i];
+    uint16_t period = (so->period + OUTPUT_SLOW_TICK - 1) / OUTPUT_SLOW_TICK;
+    OutputSlowState *st = &slow[so->pwm_id];
+    st->period = period < 1 ? 1 : period;
+    st->phase = (uint32_t) st->period * i / machine.slow_output.count;
+  }
+  chSysLock();
+  chVTSetI(&slow_vt, OUTPUT_SLOW_TICK, output_slow_tick, NULL);
+  chSysUnlock();
 }
 
 static void outputSetI(uint8_t output_id, uint8_t duty)
 {
   RadOutputChannel *ch = &radboard.output.channels[output_id];
-  if (duty > 0 && !printerIsEstopped())
+  OutputSlowState *st = &slow[output_id];
+  bool_t on = duty > 0 && !printerIsEstopped();
+  if (st->period)
+  {
+    // Takes effect on the next tick, but off is off right away
+    st->on = on ? ((uint32_t) duty * st->period + 127) / 255 : 0;
+    if (!on)
+      palDisableSig(ch->signal);
+  }
+  else if (on)
     pwmEnableChannel(ch->pwm, ch->channel, PWM_FRACTION_TO_WIDTH(ch->pwm, 255, duty));
   else
     pwmDisableChannel(ch->pwm, ch->channel);
@@ -197,7 +197,7 @@ static void plannerAddAxisPointCore(
       }
     }
   } else {
-    for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++) {
+    for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++) {
       delta.extruders[i] = 0;
     }
   }
@@ -55,6 +55,8 @@ static PrinterState state;
 
 static systime_t time_start;
 static int32_t time_spent = -1;
+static systime_t time_left_start;
+static int32_t time_left = -1;
 
 static Mutex estop_mtx;
 static uint8_t message_version = 1;
@@ -348,6 +350,7 @@ void printerTimeStartI(void)
 void printerTimeStopI(void)
 {
   time_spent = printerTimeSpent();
+  time_left = -1;
 }
 
 int32_t printerTimeSpent(void)
@@ -368,6 +371,35 @@ int32_t printerTimeSpentI(void)
   return time_spent;
 }
 
+/*
+ * Takes the time left reported by the print, in seconds, and counts it
+ * down until the next report.
+ */
+void printerTimeSetLeft(int32_t seconds)
+{
+  chSysLock();
+  time_left = seconds;
+  time_left_start = chTimeNow();
+  chSysUnlock();
+}
+
+/*
+ * Returns the time left in seconds, -1 if the print has not told.
+ */
+int32_t printerTimeLeft(void)
+{
+  int32_t ret;
+  chSysLock();
+  ret = time_left;
+  if (ret > 0)
+  {
+    int32_t elapsed = (chTimeNow() - time_left_start) / CH_FREQUENCY;
+    ret = elapsed < ret ? ret - elapsed : 0;
+  }
+  chSysUnlock();
+  return ret;
+}
+
 bool_t printerIsEstopped(void)
 {
   bool_t r;
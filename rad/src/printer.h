@@ -37,6 +37,7 @@
 
 #include "data/datahost.h"
 #include "data/datastorage.h"
+#include "data/dataprefetch.h"
 
 typedef enum {
   PRINTERSTATE_Standby = 0x00,
@@ -85,6 +86,8 @@ extern "C" {
   void printerTimeStopI(void);
   int32_t printerTimeSpent(void);
   int32_t printerTimeSpentI(void);
+  void printerTimeSetLeft(int32_t seconds);
+  int32_t printerTimeLeft(void);
   bool_t printerIsEstopped(void);
   void printerEstop(const char* message);
   void printerEstopFormatted(const char *fmt, ...);
@@ -46,9 +46,11 @@ void radInit(void)
   endstopInit();
   temperatureInit();
   debugInit();
+  // Tuned values replace the machine defaults before the planner takes them
+  storageInit();
+  settingsInit();
   plannerInit();
   uiInit();
-  storageInit();
   printerInit();
 #if HAL_USE_TM
   tmInit();
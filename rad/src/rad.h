@@ -46,6 +46,7 @@
 
 #include "radhal_radboard.h"
 #include "radhal_machine.h"
+#include "settings.h"
 
 #include "gcode_definition.h"
 #include "printer.h"
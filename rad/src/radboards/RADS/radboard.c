@@ -265,7 +265,7 @@ const radboard_t radboard =
                 .num_channels = 4,
                 .channel_mask = 0x80E0, // Ch 5,6,7,15
             },
-            .samples = (adcsample_t[]) { 0, 0, 0, 0 }
+            .samples = (adcsample_t[4 * RADADC_BUFFER_DEPTH]) { 0 }
           }
         }
     },
@@ -292,7 +292,7 @@ const radboard_t radboard =
                 .num_channels = 11,
                 .channel_mask = 0x3F1F, // Ch 1-5, 9-14
             },
-            .samples = (adcsample_t[]) { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 }
+            .samples = (adcsample_t[11 * RADADC_BUFFER_DEPTH]) { 0 }
           }
         }
     },
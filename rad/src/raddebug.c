@@ -48,6 +48,7 @@
 
 #include "debug/test_planner.h"
 #include "debug/benchmark.h"
+#include "debug/bench_host.h"
 
 volatile int32_t debug_value[24];
 
@@ -84,12 +85,14 @@ static void cmd_threads(BaseSequentialStream *chp, int argc, char *argv[]) {
   } while (tp != NULL);
 }
 
-static void cmd_dump(BaseSequentialStream *chp, int argc, char *argv[]) {
-  (void)chp;
+static void cmd_save(BaseSequentialStream *chp, int argc, char *argv[]) {
   (void)argv;
   (void)argc;
 
-  storageDumpConfig();
+  if (settingsSave())
+    chprintf(chp, "Saved to %s\r\n", SETTINGS_FILENAME);
+  else
+    chprintf(chp, "Cannot save to %s\r\n", SETTINGS_FILENAME);
 }
 
 static void cmd_erase(BaseSequentialStream *chp, int argc, char *argv[]) {
@@ -114,6 +117,14 @@ static void cmd_power(BaseSequentialStream *chp, int argc, char *argv[]) {
   }
 }
 
+static void cmd_hostdebug(BaseSequentialStream *chp, int argc, char *argv[]) {
+  if (argc != 1) {
+    chprintf(chp, "Usage: hostdebug [on|off]\r\n");
+    return;
+  }
+  dataHostSetDebugMirror(strcmp(argv[0], "on") == 0);
+}
+
 static BeeperTune tuneDebug = { .notes = (BeeperNote[]) {
   {0, 100}, {0, 0}
 } };
@@ -194,6 +205,13 @@ static void cmd_status(BaseSequentialStream *chp, int argc, char *argv[]) {
   }
 
   chprintf(chp, "\r\nStorage: %d. Queue: %d\r\n", storageGetHostState(), plannerQueueGetLength(&queueMain));
+  DataPrefetchStats prefetch;
+  dataPrefetchGetStats(&prefetch);
+  chprintf(chp, "Prefetch: %d. Fill: %u/%u (min %u). Stalls: %u. Reads: %u (max %u ms)\r\n",
+      prefetch.state, prefetch.fill, DATA_PREFETCH_SIZE, prefetch.min_fill,
+      prefetch.stalls, prefetch.reads, prefetch.max_read_time * 1000 / CH_FREQUENCY);
+  chprintf(chp, "Layer: %u/%u\r\n", dataStorageGetCurrentLayer(), dataStorageGetLayerCount());
+  chprintf(chp, "Time left: %d s\r\n", printerTimeLeft());
   printerGetMessage(0, message, sizeof(message));
   chprintf(chp, "Status: %s\r\n", message[0] ? message : "<NULL>");
 }
@@ -248,7 +266,10 @@ static void cmd_tune_temp(BaseSequentialStream *chp, int argc, char *argv[]) {
         target = strtol(argv[1], &end, 10);
         if (argv[1] == end) break;
 
-        temperatureAutoTune(ch, target, 5);
+        if (temperatureAutoTune(ch, target, 5))
+          chprintf(chp, "Autotune of %d started\r\n", ch);
+        else
+          chprintf(chp, "Cannot tune %d now\r\n", ch);
         return;
       } while(0);
     }
@@ -336,6 +357,16 @@ static void cmd_unmount(BaseSequentialStream *chp, int argc, char *argv[]) {
   storageUsbUnmount();
 }
 
+static void cmd_print(BaseSequentialStream *chp, int argc, char *argv[]) {
+  if (argc < 1) {
+    chprintf(chp, "Usage: print <file> [layer]\r\n");
+    return;
+  }
+
+  if (dataStorageSelect(argv[0]))
+    dataStoragePrintStartAt(argc > 1 ? atoi(argv[1]) : 0);
+}
+
 static void cmd_homing(BaseSequentialStream *chp, int argc, char *argv[]) {
   (void)chp;
   (void)argc;
@@ -422,8 +453,9 @@ static const ShellCommand commands[] = {
   {"mem", cmd_mem},
   {"threads", cmd_threads},
   {"erase", cmd_erase},
-  {"dump", cmd_dump},
+  {"save", cmd_save},
   {"power", cmd_power},
+  {"hostdebug", cmd_hostdebug},
   {"beep", cmd_beep},
   {"status", cmd_status},
   {"out", cmd_out},
@@ -431,6 +463,7 @@ static const ShellCommand commands[] = {
   {"tune_temp", cmd_tune_temp},
   {"mount", cmd_mount},
   {"unmount", cmd_unmount},
+  {"print", cmd_print},
   {"homing", cmd_homing},
   {"stop", cmd_stop},
   {"vel", cmd_vel},
@@ -442,6 +475,7 @@ static const ShellCommand commands[] = {
 #if RAD_TEST
   {"t", cmd_test_planner},
   {"test_planner", cmd_test_planner},
+  {"bench_host", cmd_bench_host},
 #endif
   {NULL, NULL}
 };
@@ -113,8 +113,13 @@ typedef struct {
   int8_t              heating_pwm_id;
   int8_t              cooling_pwm_id;
   systime_t           residency_time;
+  /* Time between PID updates, 0 for every sample */
+  systime_t           control_interval;
   adcconverter_t      converter;
   RadTempConfig       config;
+  RadTempGuardConfig  guard;
+  /* Simulated heater without an ADC, NULL for a stock hotend or bed */
+  const RadTempPlantConfig* plant;
 } RadTemp;
 
 typedef struct {
@@ -142,6 +147,18 @@ typedef struct {
   uint8_t             pwm_id;
 } RadFan;
 
+/**
+ * @brief An output switched in whole mains cycles instead of the hardware
+ *        PWM, for heaters behind SSRs.
+ * @details The output is on for duty/255 of every period. Slow outputs
+ *          with the same period start their on time at evenly spread
+ *          phases, so heaters sharing a supply do not switch on together.
+ */
+typedef struct {
+  uint8_t             pwm_id;
+  systime_t           period;
+} RadSlowOutput;
+
 typedef struct {
   uint8_t             enabled;
   uint8_t             input_id;
@@ -197,6 +214,10 @@ typedef struct machine_t {
     uint8_t           count;
     RadFan            *devices;
   } fan;
+  struct {
+    uint8_t           count;
+    RadSlowOutput     *devices;
+  } slow_output;
   RadUiSettings      ui;
 } machine_t;
 
@@ -68,6 +68,16 @@ typedef struct {
 } RadEndstopChannel;
 
 #if HAL_USE_ADC
+/**
+ * @brief ADC channels are converted continuously into a circular buffer.
+ *        Each half holds RADADC_OVERSAMPLE samples of every channel, so
+ *        samples needs RADADC_BUFFER_DEPTH * num_channels entries.
+ */
+#define RADADC_OVERSAMPLE     16
+#define RADADC_BUFFER_DEPTH   (2 * RADADC_OVERSAMPLE)
+/** @brief Bits of resolution gained by oversampling */
+#define RADADC_EXTRA_BITS     2
+
 typedef struct {
   ADCDriver       *adc;
   uint8_t         resolution;
@@ -26,6 +26,9 @@
  * @{
  */
 
+#include <stddef.h>
+#include <stdint.h>
+
 #include "radmath.h"
 
 float fast_inverse_square(float x)
@@ -109,4 +112,26 @@ float rad_strtof(const char *nptr, char **endptr) {
   return sign * val;
 }
 
+/*
+ * CRC-32 (IEEE 802.3), a nibble at a time. Start with crc = 0 and pass
+ * the result back in to continue over more data.
+ */
+uint32_t rad_crc32(uint32_t crc, const void *data, size_t len) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  const uint8_t *p = data;
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
 /** @} */
@@ -38,6 +38,7 @@ extern "C" {
 #endif
   float fast_inverse_square(float);
   float rad_strtof(const char *nptr, char **endptr);
+  uint32_t rad_crc32(uint32_t crc, const void *data, size_t len);
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,140 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file    settings.c
+ * @brief   Saved machine settings
+ *
+ * Values tuned on the machine, such as autotuned PID gains, are kept in
+ * a binary image on the storage and replace the defaults of machine.c
+ * at boot. A missing or damaged image leaves the defaults alone.
+ *
+ * @addtogroup SETTINGS
+ * @{
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "rad.h"
+
+/*===========================================================================*/
+/* Local variables and types.                                                */
+/*===========================================================================*/
+
+/* Too big for the stack of some callers */
+static RadSettings image;
+static Mutex mutex;
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+static void settings_collect(RadSettings* s)
+{
+  memset(s, 0, sizeof(RadSettings));
+  s->magic = SETTINGS_MAGIC;
+  s->version = SETTINGS_VERSION;
+  s->size = sizeof(RadSettings);
+  for (uint8_t i = 0; i < RAD_NUMBER_TEMPERATURES; i++)
+    s->temps[i] = temperatureGetConfig(i);
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++)
+  {
+    RadJoint* jt = &machine.kinematics.joints[i];
+    s->joints[i].max_speed = jt->max_speed;
+    s->joints[i].max_acceleration = jt->max_acceleration;
+  }
+  for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++)
+  {
+    RadExtruder* ex = &machine.extruder.devices[i];
+    s->extruders[i].max_speed = ex->max_speed;
+    s->extruders[i].max_acceleration = ex->max_acceleration;
+    s->extruders[i].max_retract_speed = ex->max_retract_speed;
+    s->extruders[i].max_retract_acceleration = ex->max_retract_acceleration;
+  }
+  s->feedrate_multiplier = printerGetFeedrateMultiplier();
+  s->flow_multiplier = printerGetFlowMultiplier();
+  s->crc = rad_crc32(0, s, offsetof(RadSettings, crc));
+}
+
+static bool_t settings_valid(const RadSettings* s, int len)
+{
+  return len == sizeof(RadSettings) &&
+      s->magic == SETTINGS_MAGIC &&
+      s->version == SETTINGS_VERSION &&
+      s->size == sizeof(RadSettings) &&
+      s->crc == rad_crc32(0, s, offsetof(RadSettings, crc));
+}
+
+static void settings_apply(const RadSettings* s)
+{
+  for (uint8_t i = 0; i < RAD_NUMBER_TEMPERATURES; i++)
+    temperatureSetConfig(i, &s->temps[i]);
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++)
+  {
+    RadJoint* jt = &machine.kinematics.joints[i];
+    jt->max_speed = s->joints[i].max_speed;
+    jt->max_acceleration = s->joints[i].max_acceleration;
+  }
+  for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++)
+  {
+    RadExtruder* ex = &machine.extruder.devices[i];
+    ex->max_speed = s->extruders[i].max_speed;
+    ex->max_acceleration = s->extruders[i].max_acceleration;
+    ex->max_retract_speed = s->extruders[i].max_retract_speed;
+    ex->max_retract_acceleration = s->extruders[i].max_retract_acceleration;
+  }
+  printerSetFeedrateMultiplier(s->feedrate_multiplier);
+  printerSetFlowMultiplier(s->flow_multiplier);
+}
+
+/*===========================================================================*/
+/* Exported functions.                                                       */
+/*===========================================================================*/
+
+/**
+ * Loads the saved settings with a single read. Runs before plannerInit(),
+ * which takes the joint limits.
+ */
+void settingsInit(void)
+{
+  chMtxInit(&mutex);
+  int len = storageLoadConfig(&image, sizeof(RadSettings));
+  if (settings_valid(&image, len)) {
+    settings_apply(&image);
+  } else if (len != STORAGE_ERROR) {
+    RAD_DEBUG_PRINTF("Settings: %s is not valid, using defaults\n", SETTINGS_FILENAME);
+  }
+}
+
+/**
+ * Saves the current settings. The card is not shared between threads,
+ * so this fails while printing from it.
+ */
+bool_t settingsSave(void)
+{
+  if (printerGetMainSource() == PRINTINGSOURCE_Storage)
+    return FALSE;
+  chMtxLock(&mutex);
+  settings_collect(&image);
+  bool_t ok = storageSaveConfig(&image, sizeof(RadSettings));
+  chMtxUnlock();
+  return ok;
+}
+
+/** @} */
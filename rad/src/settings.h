@@ -0,0 +1,79 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/**
+ * @file    settings.h
+ * @brief   Saved machine settings header
+ *
+ * @addtogroup SETTINGS
+ * @{
+ */
+#ifndef _RAD_SETTINGS_H_
+#define _RAD_SETTINGS_H_
+
+/*===========================================================================*/
+/* Data structures and types.                                                */
+/*===========================================================================*/
+
+#define SETTINGS_MAGIC 0x43444152 /* "RADC" */
+/* Bump when the meaning of a field changes, size changes are caught anyway */
+#define SETTINGS_VERSION 2
+
+/**
+ * @brief Settings image, saved as SETTINGS_FILENAME
+ * @details Written as it is in memory and only read back by the same
+ *          build, so the machine counts and layout match or the size
+ *          does not. The CRC covers everything before it.
+ */
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t size;
+  RadTempConfig temps[RAD_NUMBER_TEMPERATURES];
+  struct {
+    float max_speed;
+    float max_acceleration;
+  } joints[RAD_NUMBER_JOINTS];
+  struct {
+    float max_speed;
+    float max_acceleration;
+    float max_retract_speed;
+    float max_retract_acceleration;
+  } extruders[RAD_NUMBER_EXTRUDERS];
+  float feedrate_multiplier;
+  float flow_multiplier;
+  uint32_t crc;
+} RadSettings;
+
+/*===========================================================================*/
+/* External declarations.                                                    */
+/*===========================================================================*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+  void settingsInit(void);
+  bool_t settingsSave(void);
+#ifdef __cplusplus
+}
+#endif
+
+#endif  /* _RAD_SETTINGS_H_ */
+
+/** @} */
@@ -303,7 +303,8 @@ static void stepper_fetch_new_block(void)
   if (prev_is_velocity)
     prev_block_v = active_block.v;
   while (1)
-  {    chSysLock();
+  {
+    chSysLock();
     new_block = plannerMainQueueFetchBlockI(&active_block, active_block.mode);
     if (active_block.mode != BLOCK_Idle)
       break;
@@ -755,6 +756,39 @@ void stepperSetHomed(uint8_t joint_id)
   chSysUnlock();
 }
 
+float stepperGetCurrentSpeed(void)
+{
+  float speed = 0;
+  chSysLock();
+  if (active_block.mode == BLOCK_Positional) {
+    if (step_state.last_tick_pace > 0)
+      speed = (float)step_state.unit_tick_pace / step_state.last_tick_pace;
+  } else if (active_block.mode == BLOCK_Idle) {
+    speed = step_state.last_block_speed;
+  }
+  chSysUnlock();
+  return speed;
+}
+
+/**
+ * Returns the planned extrusion rate of the active block, in mm/s of
+ * filament. Negative while retracting.
+ */
+float stepperGetExtrusionRate(uint8_t extruder_id)
+{
+  float rate = 0;
+  chSysLock();
+  if (active_block.mode == BLOCK_Positional) {
+    if (active_block.p.distance > 0)
+      rate = active_block.p.nominal_speed *
+          active_block.p.delta.extruders[extruder_id] / active_block.p.distance;
+  } else if (active_block.mode == BLOCK_Velocity) {
+    rate = active_block.v.extruders[extruder_id].sv;
+  }
+  chSysUnlock();
+  return rate;
+}
+
 PlannerVirtualPosition stepperGetCurrentPosition(void)
 {
   PlannerVirtualPosition virtual_pos;
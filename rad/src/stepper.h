@@ -60,6 +60,8 @@ extern "C" {
   void stepperResetOldLimitState(uint8_t joint_id);
   void stepperSetHomed(uint8_t joint_id);
   PlannerVirtualPosition stepperGetCurrentPosition(void);
+  float stepperGetCurrentSpeed(void);
+  float stepperGetExtrusionRate(uint8_t extruder_id);
 #ifdef __cplusplus
 }
 #endif
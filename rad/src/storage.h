@@ -53,6 +53,12 @@ typedef enum {
 #define STORAGE_ERROR -2
 #define STORAGE_EOF -1
 
+/* One sector, lets FatFs read straight into the caller buffer */
+#define STORAGE_BLOCK_SIZE 512
+
+/* Saved settings, see settings.h */
+#define SETTINGS_FILENAME "rad.cfg"
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -60,6 +66,7 @@ extern "C" {
   void storageUsbMount(void);
   void storageUsbUnmount(void);
   RadStorageHost storageGetHostState(void);
+  uint8_t storageGetMountVersion(void);
 
   void storageChangeDir(const char* path);
   void storageOpenDir(void);
@@ -67,9 +74,16 @@ extern "C" {
   void storageCloseDir(void);
 
   bool_t storageOpenFile(const char* filename, uint32_t* sizep);
-  int storageReadChar(void);
+  int storageRead(void* buf, size_t len);
+  bool_t storageSeek(uint32_t offset);
+  void storageCloseFile(void);
+
+  bool_t storageCreateFile(const char* filename);
+  bool_t storageWrite(const void* buf, size_t len);
+  bool_t storageCloseWrite(void);
 
-  bool_t storageDumpConfig(void);
+  int storageLoadConfig(void* buf, size_t len);
+  bool_t storageSaveConfig(const void* buf, size_t len);
 #ifdef __cplusplus
 }
 #endif
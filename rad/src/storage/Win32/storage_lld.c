@@ -39,6 +39,11 @@ RadStorageHost storageGetHostState(void)
   return STORAGE_Local;
 }
 
+uint8_t storageGetMountVersion(void)
+{
+  return 0;
+}
+
 void storageChangeDir(const char* path)
 {
   SetCurrentDirectory(path);
@@ -47,6 +52,9 @@ void storageChangeDir(const char* path)
 static WIN32_FIND_DATA findFileData;
 static HANDLE dirHandle;
 static FILE* fileHandle;
+/* Full path of fileHandle, uploads must not replace it */
+static char filePath[MAX_PATH];
+static FILE* writeHandle;
 static bool_t firstCall;
 
 void storageOpenDir()
@@ -84,11 +92,12 @@ void storageCloseDir()
 
 bool_t storageOpenFile(const char* filename, uint32_t* sizep)
 {
-  if (fileHandle != NULL)
-    fclose(fileHandle);
-  fileHandle = fopen(filename, "r");
+  storageCloseFile();
+  fileHandle = fopen(filename, "rb");
   if (fileHandle == NULL)
     return FALSE;
+  if (GetFullPathName(filename, sizeof(filePath), filePath, NULL) >= sizeof(filePath))
+    filePath[0] = '\0';
 
   if (fileHandle != NULL)
   {
@@ -100,19 +109,81 @@ bool_t storageOpenFile(const char* filename, uint32_t* sizep)
   return fileHandle != NULL;
 }
 
-int storageReadChar(void)
+void storageCloseFile(void)
+{
+  if (fileHandle != NULL)
+    fclose(fileHandle);
+  fileHandle = NULL;
+  filePath[0] = '\0';
+}
+
+int storageRead(void* buf, size_t len)
 {
   if (fileHandle == NULL)
     return STORAGE_ERROR;
-  if (feof(fileHandle))
-    return STORAGE_EOF;
 
-  int c = fgetc(fileHandle);
-  if (c == EOF) return STORAGE_EOF;
+  size_t n = fread(buf, 1, len, fileHandle);
+  if (n == 0)
+    return ferror(fileHandle) ? STORAGE_ERROR : STORAGE_EOF;
+
+  return n;
+}
+
+bool_t storageSeek(uint32_t offset)
+{
+  if (fileHandle == NULL)
+    return FALSE;
+  return fseek(fileHandle, offset, SEEK_SET) == 0;
+}
+
+bool_t storageCreateFile(const char* filename)
+{
+  char path[MAX_PATH];
+  if (writeHandle != NULL)
+    fclose(writeHandle);
+  writeHandle = NULL;
+  // Truncating the file a print reads from would cut the print short
+  if (fileHandle != NULL &&
+      GetFullPathName(filename, sizeof(path), path, NULL) < sizeof(path) &&
+      lstrcmpi(path, filePath) == 0)
+    return FALSE;
+  writeHandle = fopen(filename, "wb");
+  return writeHandle != NULL;
+}
 
-  return c;
+bool_t storageWrite(const void* buf, size_t len)
+{
+  if (writeHandle == NULL)
+    return FALSE;
+  return fwrite(buf, 1, len, writeHandle) == len;
 }
 
-bool_t storageDumpConfig(void){ return TRUE; }
+bool_t storageCloseWrite(void)
+{
+  if (writeHandle == NULL)
+    return FALSE;
+  bool_t ok = fclose(writeHandle) == 0;
+  writeHandle = NULL;
+  return ok;
+}
+
+int storageLoadConfig(void* buf, size_t len)
+{
+  FILE* f = fopen(SETTINGS_FILENAME, "rb");
+  if (f == NULL)
+    return STORAGE_ERROR;
+  size_t n = fread(buf, 1, len, f);
+  fclose(f);
+  return n;
+}
+
+bool_t storageSaveConfig(const void* buf, size_t len)
+{
+  FILE* f = fopen(SETTINGS_FILENAME, "wb");
+  if (f == NULL)
+    return FALSE;
+  bool_t ok = fwrite(buf, 1, len, f) == len;
+  return fclose(f) == 0 && ok;
+}
 
 /** @} */
@@ -34,6 +34,7 @@ void storageInit(void) {}
 void storageUsbMount(void) {}
 void storageUsbUnmount(void) {}
 RadStorageHost storageGetHostState(void){ return STORAGE_None; }
+uint8_t storageGetMountVersion(void){ return 0; }
 
 void storageChangeDir(const char* path) { (void) path; }
 void storageOpenDir(void) { }
@@ -47,8 +48,51 @@ bool_t storageOpenFile(const char* filename, uint32_t* sizep)
   return FALSE;
 }
 
-int storageReadChar(void) { return STORAGE_ERROR; }
+int storageRead(void* buf, size_t len)
+{
+  (void) buf;
+  (void) len;
+  return STORAGE_ERROR;
+}
+
+bool_t storageSeek(uint32_t offset)
+{
+  (void) offset;
+  return FALSE;
+}
+
+void storageCloseFile(void) { }
+
+bool_t storageCreateFile(const char* filename)
+{
+  (void) filename;
+  return FALSE;
+}
+
+bool_t storageWrite(const void* buf, size_t len)
+{
+  (void) buf;
+  (void) len;
+  return FALSE;
+}
+
+bool_t storageCloseWrite(void)
+{
+  return FALSE;
+}
 
-bool_t storageDumpConfig(void){ return TRUE; }
+int storageLoadConfig(void* buf, size_t len)
+{
+  (void) buf;
+  (void) len;
+  return STORAGE_ERROR;
+}
+
+bool_t storageSaveConfig(const void* buf, size_t len)
+{
+  (void) buf;
+  (void) len;
+  return FALSE;
+}
 
 /** @} */
@@ -38,12 +38,16 @@ static WORKING_AREA(waStorage, 256);
 static Mutex mutex;
 
 static RadStorageHost host;
-
-#define SETTINGS_FILENAME "rad.cfg"
+/* Bumped whenever the card contents may have changed */
+static uint8_t mount_version;
 
 FATFS fsWorkArea;
 DIR dir;
 FIL file;
+static bool_t read_open;
+/* Uploads are written while a print may read from file */
+static FIL write_file;
+static bool_t write_open;
 
 /*===========================================================================*/
 /* Local functions.                                                          */
@@ -58,17 +62,20 @@ static void storageCheck(void) {
   if (host == STORAGE_None) {
     if (blkIsInserted(radboard.hmi.storage_device)) {
       host = STORAGE_Local;
+      mount_version++;
       f_mount(0, &fsWorkArea);
     }
   } else if (host == STORAGE_Usb) {
 #if HAL_USE_MSD
     if (radboard.hmi.usb_msd->bbdp == NULL) {
       host = STORAGE_None;
+      mount_version++;
     }
 #endif
   } else if (host == STORAGE_Local) {
     if (!blkIsInserted(radboard.hmi.storage_device)) {
       host = STORAGE_None;
+      mount_version++;
       f_mount(0, NULL);
     }
   }
@@ -102,8 +109,13 @@ void storageUsbMount(void)
 {
 #if HAL_USE_MSD
   chMtxLock(&mutex);
+  // The card is the PC's from here, an upload in progress is cut short
+  if (write_open)
+    f_close(&write_file);
+  write_open = FALSE;
   msdReady(radboard.hmi.usb_msd, radboard.hmi.storage_device);
   host = STORAGE_Usb;
+  mount_version++;
   chMtxUnlock();
 #endif
 }
@@ -125,26 +137,43 @@ RadStorageHost storageGetHostState(void)
   return _host;
 }
 
+uint8_t storageGetMountVersion(void)
+{
+  chMtxLock(&mutex);
+  uint8_t version = mount_version;
+  chMtxUnlock();
+  return version;
+}
+
 void storageChangeDir(const char* path)
 {
+  chMtxLock(&mutex);
   f_chdir(path);
+  chMtxUnlock();
 }
 
 void storageOpenDir(void)
 {
+  chMtxLock(&mutex);
   f_opendir(&dir, ".");
+  chMtxUnlock();
 }
 
+/*
+ * The name is kept in a static FILINFO, valid until the next call.
+ */
 bool_t storageFetchFileInfo(RadFileInfo* file)
 {
-  FILINFO fno;
+  static FILINFO fno;
+  bool_t ok;
+  chMtxLock(&mutex);
   do
   {
-    if (f_readdir(&dir, &fno) != FR_OK)
-      return FALSE;
-    if (fno.fname[0] == 0)
-      return FALSE;
-  } while ((fno.fattrib & (AM_SYS | AM_HID)) != 0 || fno.fname[0] == '.');
+    ok = f_readdir(&dir, &fno) == FR_OK && fno.fname[0] != 0;
+  } while (ok && ((fno.fattrib & (AM_SYS | AM_HID)) != 0 || fno.fname[0] == '.'));
+  chMtxUnlock();
+  if (!ok)
+    return FALSE;
   file->type = fno.fattrib & AM_DIR ? FILETYPE_Directory : FILETYPE_File;
   file->filename = fno.fname;
   return TRUE;
@@ -157,33 +186,132 @@ void storageCloseDir(void)
 
 bool_t storageOpenFile(const char* filename, uint32_t* sizep)
 {
+  chMtxLock(&mutex);
   f_close(&file);
-  if (f_open(&file, filename, FA_READ) != FR_OK)
+  bool_t ok = read_open = f_open(&file, filename, FA_READ) == FR_OK;
+  if (ok)
+    *sizep = f_size(&file);
+  chMtxUnlock();
+  return ok;
+}
+
+void storageCloseFile(void)
+{
+  chMtxLock(&mutex);
+  if (read_open)
+    f_close(&file);
+  read_open = FALSE;
+  chMtxUnlock();
+}
+
+int storageRead(void* buf, size_t len)
+{
+  UINT br;
+  int ret;
+  chMtxLock(&mutex);
+  if (f_read(&file, buf, len, &br) != FR_OK)
+    ret = STORAGE_ERROR;
+  else if (br == 0)
+    ret = STORAGE_EOF;
+  else
+    ret = br;
+  chMtxUnlock();
+  return ret;
+}
+
+bool_t storageSeek(uint32_t offset)
+{
+  chMtxLock(&mutex);
+  bool_t ok = f_lseek(&file, offset) == FR_OK && f_tell(&file) == offset;
+  chMtxUnlock();
+  return ok;
+}
+
+/*
+ * Same directory entry as the file open for reading. Creating it would
+ * truncate the file under the print.
+ */
+static bool_t is_read_file(const char* filename)
+{
+  FIL f;
+  if (!read_open || f_open(&f, filename, FA_READ) != FR_OK)
     return FALSE;
-  *sizep = f_size(&file);
-  return TRUE;
+  bool_t same = f.dir_sect == file.dir_sect && f.dir_ptr == file.dir_ptr;
+  f_close(&f);
+  return same;
 }
 
-int storageReadChar(void)
+bool_t storageCreateFile(const char* filename)
 {
-  char c;
+  chMtxLock(&mutex);
+  if (write_open)
+    f_close(&write_file);
+  write_open = host == STORAGE_Local && !is_read_file(filename) &&
+      f_open(&write_file, filename, FA_CREATE_ALWAYS | FA_WRITE) == FR_OK;
+  chMtxUnlock();
+  return write_open;
+}
+
+/*
+ * Writes of whole sectors at sector aligned offsets go from buf to the
+ * card without passing through the FatFs window.
+ */
+bool_t storageWrite(const void* buf, size_t len)
+{
+  UINT bw;
+  chMtxLock(&mutex);
+  bool_t ok = write_open && host == STORAGE_Local &&
+      f_write(&write_file, buf, len, &bw) == FR_OK && bw == len;
+  chMtxUnlock();
+  return ok;
+}
+
+bool_t storageCloseWrite(void)
+{
+  chMtxLock(&mutex);
+  bool_t ok = write_open && f_close(&write_file) == FR_OK;
+  write_open = FALSE;
+  mount_version++;
+  chMtxUnlock();
+  return ok;
+}
+
+/*
+ * Reads the settings file into buf. Mounts the card first if it is in,
+ * so it works at boot before the storage thread has looked. Returns the
+ * number of bytes read or STORAGE_ERROR.
+ */
+int storageLoadConfig(void* buf, size_t len) {
+  FIL f;
   UINT br;
-  if (f_read(&file, &c, 1, &br) != FR_OK)
+  int ret = STORAGE_ERROR;
+
+  if (radboard.hmi.storage_device == NULL)
     return STORAGE_ERROR;
-  if (br == 0)
-    return STORAGE_EOF;
-  return c;
+  storageCheck();
+  chMtxLock(&mutex);
+  if (host == STORAGE_Local && f_open(&f, SETTINGS_FILENAME, FA_READ) == FR_OK) {
+    if (f_read(&f, buf, len, &br) == FR_OK)
+      ret = br;
+    f_close(&f);
+  }
+  chMtxUnlock();
+  return ret;
 }
 
-bool_t storageDumpConfig(void) {
+bool_t storageSaveConfig(const void* buf, size_t len) {
   FIL f;
+  UINT bw;
 
   chMtxLock(&mutex);
   if (host != STORAGE_Local)
     goto failed;
   if (f_open(&f, SETTINGS_FILENAME, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK)
     goto failed;
-  // storageDumpConfigCore(&f);
+  if (f_write(&f, buf, len, &bw) != FR_OK || bw != len) {
+    f_close(&f);
+    goto failed;
+  }
   if (f_close(&f) != FR_OK)
     goto failed;
   chMtxUnlock();
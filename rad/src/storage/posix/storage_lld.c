@@ -0,0 +1,229 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * @file    storage_lld.c
+ * @brief   Storage on a POSIX host
+ *
+ * The working directory stands in for the card. The file being printed
+ * is mapped into memory, so reads are a copy out of the page cache.
+ *
+ * @addtogroup STORAGE
+ * @{
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "rad.h"
+
+static DIR* dirHandle;
+static int fileHandle = -1;
+static const char* fileData;
+static size_t fileSize;
+static size_t filePos;
+static int writeHandle = -1;
+
+void storageCloseFile(void)
+{
+  if (fileData != NULL)
+    munmap((void*) fileData, fileSize);
+  if (fileHandle >= 0)
+    close(fileHandle);
+  fileHandle = -1;
+  fileData = NULL;
+  fileSize = 0;
+  filePos = 0;
+}
+
+void storageInit(void) {}
+void storageUsbMount(void) {}
+void storageUsbUnmount(void) {}
+
+RadStorageHost storageGetHostState(void)
+{
+  return STORAGE_Local;
+}
+
+uint8_t storageGetMountVersion(void)
+{
+  return 0;
+}
+
+void storageChangeDir(const char* path)
+{
+  if (chdir(path) != 0)
+    RAD_DEBUG_PRINTF("STORAGE: cannot enter %s\n", path);
+}
+
+void storageOpenDir(void)
+{
+  storageCloseDir();
+  dirHandle = opendir(".");
+}
+
+bool_t storageFetchFileInfo(RadFileInfo* file)
+{
+  if (dirHandle == NULL)
+    return FALSE;
+
+  struct dirent* entry;
+  do {
+    entry = readdir(dirHandle);
+    if (entry == NULL)
+      return FALSE;
+  } while (entry->d_name[0] == '.');
+
+  bool_t directory;
+#ifdef _DIRENT_HAVE_D_TYPE
+  if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK)
+    directory = entry->d_type == DT_DIR;
+  else
+#endif
+  {
+    struct stat stat_buf;
+    directory = stat(entry->d_name, &stat_buf) == 0 && S_ISDIR(stat_buf.st_mode);
+  }
+
+  file->filename = entry->d_name;
+  file->type = directory ? FILETYPE_Directory : FILETYPE_File;
+  return TRUE;
+}
+
+void storageCloseDir(void)
+{
+  if (dirHandle == NULL) return;
+  closedir(dirHandle);
+  dirHandle = NULL;
+}
+
+bool_t storageOpenFile(const char* filename, uint32_t* sizep)
+{
+  storageCloseFile();
+  fileHandle = open(filename, O_RDONLY);
+  if (fileHandle < 0)
+    return FALSE;
+
+  struct stat stat_buf;
+  if (fstat(fileHandle, &stat_buf) != 0 || !S_ISREG(stat_buf.st_mode)) {
+    storageCloseFile();
+    return FALSE;
+  }
+
+  // Nothing to map for an empty file, reads return EOF straight away
+  fileSize = stat_buf.st_size;
+  if (fileSize > 0)
+  {
+    void* data = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fileHandle, 0);
+    if (data == MAP_FAILED) {
+      fileSize = 0;
+      storageCloseFile();
+      return FALSE;
+    }
+    madvise(data, fileSize, MADV_SEQUENTIAL);
+    fileData = data;
+  }
+
+  *sizep = fileSize;
+  return TRUE;
+}
+
+int storageRead(void* buf, size_t len)
+{
+  if (fileHandle < 0)
+    return STORAGE_ERROR;
+  if (filePos >= fileSize)
+    return STORAGE_EOF;
+
+  if (len > fileSize - filePos)
+    len = fileSize - filePos;
+  memcpy(buf, fileData + filePos, len);
+  filePos += len;
+  return len;
+}
+
+bool_t storageSeek(uint32_t offset)
+{
+  if (fileHandle < 0 || offset > fileSize)
+    return FALSE;
+  filePos = offset;
+  return TRUE;
+}
+
+/*
+ * Same file as the one open for reading. Truncating it would fault the
+ * mapping the print reads from.
+ */
+static bool_t is_read_file(const char* filename)
+{
+  struct stat read_stat, stat_buf;
+  return fileHandle >= 0 &&
+      fstat(fileHandle, &read_stat) == 0 &&
+      stat(filename, &stat_buf) == 0 &&
+      stat_buf.st_dev == read_stat.st_dev &&
+      stat_buf.st_ino == read_stat.st_ino;
+}
+
+bool_t storageCreateFile(const char* filename)
+{
+  if (writeHandle >= 0)
+    close(writeHandle);
+  writeHandle = -1;
+  if (is_read_file(filename))
+    return FALSE;
+  writeHandle = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  return writeHandle >= 0;
+}
+
+bool_t storageWrite(const void* buf, size_t len)
+{
+  if (writeHandle < 0)
+    return FALSE;
+  return write(writeHandle, buf, len) == (ssize_t) len;
+}
+
+bool_t storageCloseWrite(void)
+{
+  if (writeHandle < 0)
+    return FALSE;
+  bool_t ok = close(writeHandle) == 0;
+  writeHandle = -1;
+  return ok;
+}
+
+int storageLoadConfig(void* buf, size_t len)
+{
+  int fd = open(SETTINGS_FILENAME, O_RDONLY);
+  if (fd < 0)
+    return STORAGE_ERROR;
+  ssize_t n = read(fd, buf, len);
+  close(fd);
+  return n < 0 ? STORAGE_ERROR : n;
+}
+
+bool_t storageSaveConfig(const void* buf, size_t len)
+{
+  int fd = open(SETTINGS_FILENAME, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return FALSE;
+  bool_t ok = write(fd, buf, len) == (ssize_t) len;
+  return close(fd) == 0 && ok;
+}
+
+/** @} */
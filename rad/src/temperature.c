@@ -38,8 +38,64 @@
 
 static RadTempPidState pid_states[RAD_NUMBER_TEMPERATURES];
 static RadTempState temperatures[RAD_NUMBER_TEMPERATURES];
+static RadTempGuardState guard_states[RAD_NUMBER_TEMPERATURES];
+
+/*
+ * What temperatureGet() returns, copied from temperatures[] by the
+ * writers under chSysLock(). Readers do not lock: they retry when the
+ * sequence number is odd or has moved while they copied.
+ */
+static RadTempState published[RAD_NUMBER_TEMPERATURES];
+static volatile uint32_t published_seq[RAD_NUMBER_TEMPERATURES];
+
+/* Keeps the compiler from moving memory accesses across it */
+#define TEMPERATURE_BARRIER() __asm__ __volatile__("" ::: "memory")
 
 #include "temperature_pid.h"
+#include "temperature_guard.h"
+#include "temperature_history.h"
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+static void temperature_publishI(uint8_t temp_id)
+{
+  published_seq[temp_id]++;
+  TEMPERATURE_BARRIER();
+  published[temp_id] = temperatures[temp_id];
+  TEMPERATURE_BARRIER();
+  published_seq[temp_id]++;
+}
+
+/*
+ * Stores a new reading, which was checked valid or not by the guard, and
+ * publishes it. The target counts as reached once the reading has been
+ * at it for the residency time of the heater. Returns the target.
+ */
+static float temperature_update(uint8_t temp_id, float pv, adcsample_t raw,
+                                bool_t valid)
+{
+  RadTempState *s = &temperatures[temp_id];
+  systime_t residency_time = machine.temperature.devices[temp_id].residency_time;
+  if (residency_time == 0)
+    residency_time = S2ST(10);
+
+  chSysLock();
+  systime_t now = chTimeNow();
+  s->pv = pv;
+  s->raw = raw;
+  float sv = s->sv;
+  if (valid && !s->target_reached_at)
+    if ((s->is_heating && s->pv >= sv) ||
+        (!s->is_heating && s->pv <= sv))
+      s->target_reached_at = now;
+  if (!s->target_reached && s->target_reached_at)
+    s->target_reached = now - s->target_reached_at > residency_time;
+  temperature_publishI(temp_id);
+  chSysUnlock();
+  return sv;
+}
 
 #if HAL_USE_ADC
 #include "temperature_core_real.h"
@@ -58,6 +114,7 @@ static void temperatureSetI(uint8_t temp_id, float temp)
   t->is_heating = t->sv > t->pv;
   t->target_reached = 0;
   t->target_reached_at = 0;
+  temperature_publishI(temp_id);
 }
 
 void temperatureSet(uint8_t temp_id, float temp)
@@ -78,6 +135,10 @@ void temperatureAllZero(void)
   chSysUnlock();
 }
 
+/**
+ * Returns the state of a sensor as of its last reading or target change.
+ * Does not lock, so it is cheap enough to poll.
+ */
 RadTempState temperatureGet(uint8_t temp_id)
 {
   RadTempState temp;
@@ -88,24 +149,134 @@ RadTempState temperatureGet(uint8_t temp_id)
     return temp;
   }
 
+  uint32_t seq;
+  do {
+    seq = published_seq[temp_id];
+    TEMPERATURE_BARRIER();
+    temp = published[temp_id];
+    TEMPERATURE_BARRIER();
+  } while ((seq & 1) || seq != published_seq[temp_id]);
+  return temp;
+}
+
+RadTempConfig temperatureGetConfig(uint8_t temp_id)
+{
+  RadTempConfig config;
   chSysLock();
-  temp = temperatures[temp_id];
-  if (!temp.target_reached && temp.target_reached_at)
+  config = pid_states[temp_id].config;
+  chSysUnlock();
+  return config;
+}
+
+void temperatureSetConfig(uint8_t temp_id, const RadTempConfig* config)
+{
+  chSysLock();
+  temperature_pid_configure(&pid_states[temp_id], config);
+  chSysUnlock();
+}
+
+/**
+ * Starts a relay autotune of a heater, run by the temperature thread
+ * next to the other heaters. The gains found replace the current ones
+ * when it finishes. Returns FALSE if the heater cannot be tuned now.
+ */
+bool_t temperatureAutoTune(uint8_t temp_id, float target, uint8_t total_cycles)
+{
+  if (temp_id >= RAD_NUMBER_TEMPERATURES || total_cycles == 0)
+    return FALSE;
+
+  RadTemp* cht = &machine.temperature.devices[temp_id];
+  if (cht->heating_pwm_id < 0 || printerIsEstopped())
+    return FALSE;
+
+  RadTempPidState* state = &pid_states[temp_id];
+  RadTempTuneState* tune = &state->tune;
+  systime_t now = chTimeNow();
+
+  chSysLock();
+  if (state->tuning_cycle_remains > 0)
   {
-    systime_t residency_time = machine.temperature.devices[temp_id].residency_time;
-    if (residency_time == 0)
-      residency_time = S2ST(10);
-    temp.target_reached = chTimeNow() - temp.target_reached_at > residency_time;
+    chSysUnlock();
+    return FALSE;
   }
+  memset(tune, 0, sizeof(RadTempTuneState));
+  tune->target = target;
+  tune->pv_low = 10000;
+  tune->bias = tune->d = 255 / 2;
+  tune->t1 = now - S2ST(10);
+  tune->t2 = now;
+  tune->last_report = now;
+  tune->backup = state->config;
+  state->tuning_cycle_remains = total_cycles;
   chSysUnlock();
-  return temp;
+
+  outputSet(cht->heating_pwm_id, 0);
+  return TRUE;
+}
+
+/**
+ * Returns the cycles left of a running autotune, 0 if there is none.
+ */
+uint8_t temperatureGetAutoTune(uint8_t temp_id)
+{
+  if (temp_id >= RAD_NUMBER_TEMPERATURES)
+    return 0;
+  chSysLock();
+  uint8_t remains = pid_states[temp_id].tuning_cycle_remains;
+  chSysUnlock();
+  return remains;
+}
+
+/**
+ * Returns the sequence number the next history entry will have.
+ */
+uint32_t temperatureGetHistorySequence(void)
+{
+  chSysLock();
+  uint32_t seq = history_seq;
+  chSysUnlock();
+  return seq;
+}
+
+/**
+ * Copies up to count history entries of a sensor, in 0.1 degC, starting
+ * from entry *seq. Entries gone from the ring are skipped, *seq is moved
+ * to the first one copied. Returns the number copied, so the next read
+ * starts from *seq plus that.
+ */
+uint16_t temperatureGetHistory(uint8_t temp_id, uint32_t* seq,
+                               int16_t* values, uint16_t count)
+{
+  if (temp_id >= RAD_NUMBER_TEMPERATURES)
+    return 0;
+
+  uint16_t n = 0;
+  chSysLock();
+  if (*seq > history_seq)
+    *seq = history_seq;
+  else if (history_seq - *seq > TEMPERATURE_HISTORY_SIZE)
+    *seq = history_seq - TEMPERATURE_HISTORY_SIZE;
+  // Stops early if the recorder catches up with the oldest entry read
+  while (n < count && *seq + n < history_seq &&
+         history_seq - (*seq + n) <= TEMPERATURE_HISTORY_SIZE)
+  {
+    values[n] = history[(*seq + n) % TEMPERATURE_HISTORY_SIZE][temp_id];
+    // Keep the lock short, the entries are not written that often
+    if (++n % 16 == 0)
+    {
+      chSysUnlock();
+      chSysLock();
+    }
+  }
+  chSysUnlock();
+  return n;
 }
 
 void temperatureInit()
 {
   for (uint8_t i = 0; i < RAD_NUMBER_TEMPERATURES; i++)
   {
-    pid_states[i].config = machine.temperature.devices[i].config;
+    temperature_pid_configure(&pid_states[i], &machine.temperature.devices[i].config);
   }
   temperature_core_init();
   chThdCreateStatic(waTemp, sizeof(waTemp), NORMALPRIO, threadTemp, NULL);
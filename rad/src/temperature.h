@@ -32,18 +32,59 @@
 /* Data structures and types.                                                */
 /*===========================================================================*/
 
+#include "temperature_plant.h"
+
 #define TEMPERATURE_UNKNOWN_VALUE 999
 
 #if !HAL_USE_ADC
 typedef uint16_t adcsample_t;
 #endif
 
+/* Temperatures are sampled at this interval, heaters controlled at theirs */
+#define TEMPERATURE_SAMPLE_INTERVAL MS2ST(50)
+
+/* Readings kept for graphs, in 0.1 degC, 10 minutes by default */
+#ifndef TEMPERATURE_HISTORY_SIZE
+#define TEMPERATURE_HISTORY_SIZE 600
+#endif
+#define TEMPERATURE_HISTORY_INTERVAL S2ST(1)
+
+/* Feed-forward is relative to this temperature */
+#define TEMPERATURE_AMBIENT 25
+
+/**
+ * @brief PID gains, in duty (0-255) per degC. Ki is per second and Kd in
+ *        seconds, so they hold at any control interval.
+ * @details The feed-forward terms add the duty that extrusion and the
+ *          cooling fan take away, in duty per degC of target above
+ *          TEMPERATURE_AMBIENT: Kf_flow per mm/s of filament, Kf_fan at
+ *          full fan. 0 turns them off.
+ */
 typedef struct {
   float   Kp;
   float   Ki;
   float   Kd;
+  float   Kf_flow;
+  float   Kf_fan;
 } RadTempConfig;
 
+/**
+ * @brief Thermal protection limits of a heater, 0 for the defaults of
+ *        temperature_guard.h.
+ * @details While heating far from the target, the temperature must rise
+ *          by heating_rise in every heating_period. Once the target is
+ *          reached it may stay more than hysteresis below it for at most
+ *          hysteresis_period.
+ */
+typedef struct {
+  float     max_temp;
+  float     min_temp;
+  systime_t heating_period;
+  float     heating_rise;
+  float     hysteresis;
+  systime_t hysteresis_period;
+} RadTempGuardConfig;
+
 typedef struct {
   float               sv;
   float               pv;
@@ -53,15 +94,49 @@ typedef struct {
   bool_t              target_reached;
 } RadTempState;
 
+/* Relay autotune of one heater, stepped by the temperature thread */
+typedef struct {
+  float     target;
+  float     pv_high;
+  float     pv_low;
+  systime_t t1;
+  systime_t t2;
+  systime_t t_high;
+  systime_t t_low;
+  systime_t last_report;
+  int32_t   bias;
+  int32_t   d;
+  uint8_t   cycles;
+  bool_t    heating;
+  RadTempConfig backup;
+} RadTempTuneState;
+
+/*
+ * PID state in fixed point: temperatures are 1/256 degC (Q8) and terms
+ * are duty in Q16. Gains are scaled from the config by temperature_pid.h.
+ */
 typedef struct {
   RadTempConfig config;
-  float   error;
-  float   i_error;
-  float   d_state;
-  float   d_pv;
+  int32_t kp;
+  int32_t ki;
+  int32_t kd;
+  int32_t i_term;
+  int32_t d_term;
+  int32_t last_pv;
+  systime_t last_time;
+  bool_t  running;
   uint8_t tuning_cycle_remains;
+  RadTempTuneState tune;
 } RadTempPidState;
 
+/* Thermal protection of a heater, see temperature_guard.h */
+typedef struct {
+  float     sv;
+  float     mark;
+  systime_t since;
+  uint8_t   sensor_faults;
+} RadTempGuardState;
+
 /*===========================================================================*/
 /* External declarations.                                                    */
 /*===========================================================================*/
@@ -73,7 +148,13 @@ extern "C" {
   void temperatureSet(uint8_t temp_id, float temp);
   void temperatureAllZero(void);
   RadTempState temperatureGet(uint8_t temp_id);
-  void temperatureAutoTune(uint8_t temp_id, float target, uint8_t total_cycles);
+  RadTempConfig temperatureGetConfig(uint8_t temp_id);
+  void temperatureSetConfig(uint8_t temp_id, const RadTempConfig* config);
+  bool_t temperatureAutoTune(uint8_t temp_id, float target, uint8_t total_cycles);
+  uint8_t temperatureGetAutoTune(uint8_t temp_id);
+  uint32_t temperatureGetHistorySequence(void);
+  uint16_t temperatureGetHistory(uint8_t temp_id, uint32_t* seq,
+                                 int16_t* values, uint16_t count);
 #ifdef __cplusplus
 }
 #endif
@@ -34,9 +34,40 @@
 /* Exported functions.                                                       */
 /*===========================================================================*/
 
+/**
+ * Converts a sample with a thermistor table. Samples are scaled to 16 bits
+ * by repeating the top bits, so the full scale reading stays full scale.
+ */
+float thermistorConvert(const ThermistorTable* table,
+                        const adcsample_t sample, const uint8_t resolution)
+{
+  adcsample_t limit = (1 << (resolution - 8));
+  if (sample <= limit) return 999;
+  adcsample_t inv_sample = (1 << resolution) - 1 - sample;
+  if (inv_sample <= limit) return 999;
+
+  uint16_t s = (sample << (16 - resolution)) | (sample >> (2 * resolution - 16));
+  if (s < table->adc[THERMISTOR_TABLE_SIZE - 1]) return 999;
+
+  // Readings fall as the temperature rises
+  uint8_t lo = 0, hi = THERMISTOR_TABLE_SIZE - 1;
+  while (hi - lo > 1)
+  {
+    uint8_t mid = (lo + hi) / 2;
+    if (table->adc[mid] >= s)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  // Below the table it carries on along the first step
+  int32_t t = THERMISTOR_TABLE_TEMP(lo) * 256 +
+      (((int32_t) table->slope[lo] * ((int32_t) table->adc[lo] - s)) >> THERMISTOR_SLOPE_SHIFT);
+  return t / 256.0f;
+}
+
 #ifdef TEMP_R2
-// 100k thermistor - best choice for EPCOS 100k (B57540G0104F000)
-MAKE_THERMISTOR_CONVERTER(adccType1, TEMP_R2, 100000, 25, 4066);
+MAKE_THERMISTOR_CONVERTER(adccType1, TEMP_R2, THERMISTOR_TYPE1);
 #endif
 
 float adccSAM3XATempSensor(const adcsample_t sample, const uint8_t resolution)
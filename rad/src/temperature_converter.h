@@ -34,30 +34,92 @@
 /* Macro definitions                                                         */
 /*===========================================================================*/
 
+/*
+ * Thermistor tables hold the ADC reading, scaled to 16 bits, at every
+ * THERMISTOR_TABLE_STEP degrees from THERMISTOR_TABLE_MIN, and the slope
+ * of each step. Readings beyond the hot end convert to 999.
+ */
+#define THERMISTOR_TABLE_SIZE 128
+#define THERMISTOR_TABLE_MIN  -20
+#define THERMISTOR_TABLE_STEP 4
+/* Slopes are 1/256 degC per count, scaled by 2^16 */
+#define THERMISTOR_SLOPE_SHIFT 16
+
+#define THERMISTOR_TABLE_TEMP(i) \
+  (THERMISTOR_TABLE_MIN + (i) * THERMISTOR_TABLE_STEP)
+
+/* Reading at step i of a divider with R2 to the supply, folded by the compiler */
+#define THERMISTOR_TABLE_ADC(i, R2, R0, T0, BETA)                           \
+  ((uint16_t) (0.5 + 65535.0 / (1 + (R2) / ((R0) * __builtin_exp(          \
+      (BETA) * (1.0 / (THERMISTOR_TABLE_TEMP(i) + 273.15) -                 \
+                1.0 / ((T0) + 273.15)))))))
+
+#define THERMISTOR_TABLE_SLOPE(i, ...)                                      \
+  ((uint32_t) ((THERMISTOR_TABLE_STEP << (8 + THERMISTOR_SLOPE_SHIFT)) /    \
+      (THERMISTOR_TABLE_ADC(i, __VA_ARGS__) -                               \
+       THERMISTOR_TABLE_ADC((i) + 1, __VA_ARGS__))))
+
+#define THERMISTOR_ADC_ENTRY(i, ...) THERMISTOR_TABLE_ADC(i, __VA_ARGS__),
+#define THERMISTOR_SLOPE_ENTRY(i, ...) THERMISTOR_TABLE_SLOPE(i, __VA_ARGS__),
+
+#define THERMISTOR_ROWS_4(X, i, ...)                                        \
+  X(i, __VA_ARGS__) X((i) + 1, __VA_ARGS__)                                 \
+  X((i) + 2, __VA_ARGS__) X((i) + 3, __VA_ARGS__)
+#define THERMISTOR_ROWS_16(X, i, ...)                                       \
+  THERMISTOR_ROWS_4(X, i, __VA_ARGS__)                                      \
+  THERMISTOR_ROWS_4(X, (i) + 4, __VA_ARGS__)                                \
+  THERMISTOR_ROWS_4(X, (i) + 8, __VA_ARGS__)                                \
+  THERMISTOR_ROWS_4(X, (i) + 12, __VA_ARGS__)
+#define THERMISTOR_ROWS_64(X, i, ...)                                       \
+  THERMISTOR_ROWS_16(X, i, __VA_ARGS__)                                     \
+  THERMISTOR_ROWS_16(X, (i) + 16, __VA_ARGS__)                              \
+  THERMISTOR_ROWS_16(X, (i) + 32, __VA_ARGS__)                              \
+  THERMISTOR_ROWS_16(X, (i) + 48, __VA_ARGS__)
+#define THERMISTOR_ROWS(X, ...)                                             \
+  THERMISTOR_ROWS_64(X, 0, __VA_ARGS__)                                     \
+  THERMISTOR_ROWS_64(X, 64, __VA_ARGS__)
+
+/**
+ * @brief Thermistor parameters R0, T0, BETA, shared with the host check
+ *        in tools/thermcheck.
+ */
+/* 100k thermistor - best choice for EPCOS 100k (B57540G0104F000) */
+#define THERMISTOR_TYPE1 100000, 25, 4066
+
 /**
  * @brief Generate converter function for NTC thermistor.
  *        NAME is the function name,
  *        R2 is the onboard resistor,
- *        BETA, R0, T0 are thermisitor parameters (T0 is in celsius)
+ *        BETA, R0, T0 are thermisitor parameters (T0 is in celsius),
+ *        or one of the THERMISTOR_TYPE* macros above.
+ * @details The table is computed at compile time, a conversion is a
+ *          binary search and one multiply.
  */
-#define MAKE_THERMISTOR_CONVERTER(NAME, R2, R0, T0, BETA)                   \
+#define MAKE_THERMISTOR_CONVERTER(NAME, R2, ...)                            \
+  MAKE_THERMISTOR_CONVERTER_(NAME, R2, __VA_ARGS__)
+#define MAKE_THERMISTOR_CONVERTER_(NAME, R2, R0, T0, BETA)                  \
+static const ThermistorTable NAME##_table = {                               \
+  .adc = { THERMISTOR_ROWS(THERMISTOR_ADC_ENTRY, R2, R0, T0, BETA) },       \
+  /* The last slope is past the table and never used */                    \
+  .slope = { THERMISTOR_ROWS(THERMISTOR_SLOPE_ENTRY, R2, R0, T0, BETA) }    \
+};                                                                          \
 float (NAME)(const adcsample_t sample, const uint8_t resolution)            \
 {                                                                           \
-  adcsample_t limit = (1 << (resolution - 8));                              \
-  if (sample <= limit) return 999;                                          \
-  adcsample_t inv_sample = (1 << resolution) - 1 - sample;                  \
-  if (inv_sample <= limit) return 999;                                      \
-  return -273.15 +                                                          \
-    BETA / log(                                                             \
-      sample * (R2) / inv_sample /                                          \
-      ((R0) * exp(-(BETA) / (T0 + 273.15)))                                 \
-    );                                                                      \
+  return thermistorConvert(&NAME##_table, sample, resolution);              \
 }
 
 /*===========================================================================*/
 /* Data structures and types.                                                */
 /*===========================================================================*/
 
+/**
+ * @brief Thermistor table, see MAKE_THERMISTOR_CONVERTER
+ */
+typedef struct {
+  uint16_t adc[THERMISTOR_TABLE_SIZE];
+  uint32_t slope[THERMISTOR_TABLE_SIZE];
+} ThermistorTable;
+
 /**
  * @brief Conversion function for converting sample into temperature result
  */
@@ -70,6 +132,8 @@ typedef float (*adcconverter_t)(const adcsample_t sample, const uint8_t resoluti
 #ifdef __cplusplus
 extern "C" {
 #endif
+  float thermistorConvert(const ThermistorTable* table,
+                          const adcsample_t sample, const uint8_t resolution);
   float adccSAM3XATempSensor(const adcsample_t sample, const uint8_t resolution);
   float adccDummy(const adcsample_t sample, const uint8_t resolution);
   float adccFixedDummy(const adcsample_t sample, const uint8_t resolution);
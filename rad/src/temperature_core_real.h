@@ -36,38 +36,104 @@
 /* Local variables and types.                                                */
 /*===========================================================================*/
 
+/* Channels over all ADCs, as counted by adc_id */
+#define RADADC_MAX_CHANNELS 16
+
+/* Readings of a channel since the temperature thread last took them */
+typedef struct {
+  uint32_t sum;
+  uint32_t count;
+} RadAdcFilter;
+
 static WORKING_AREA(waTemp, 512);
 
-int8_t finishing_count = 0;
-int8_t has_error = 0;
-Thread* tp;
+static RadAdcFilter filters[RADADC_MAX_CHANNELS];
 
 /*===========================================================================*/
 /* Local functions.                                                          */
 /*===========================================================================*/
 
-void radadc_end_callback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
+static uint8_t radadc_first_channel(ADCDriver *adcp)
 {
-  (void)adcp;
-  (void)buffer;
-  (void)n;
-  if (--finishing_count == 0) {
-    chSysLockFromIsr();
-    chSchReadyI(tp);
-    chSysUnlockFromIsr();
+  uint8_t c = 0;
+  for (uint8_t i = 0; i < RAD_NUMBER_ADCS; i++) {
+    if (radboard.adc.channels[i].adc == adcp)
+      break;
+    c += radboard.adc.channels[i].group_base.num_channels;
   }
+  return c;
 }
 
-void radadc_error_callback(ADCDriver *adcp, adcerror_t err)
+/*
+ * Called when half of the circular buffer is filled, with n samples of
+ * each channel. The lowest and highest samples are dropped as spikes and
+ * the rest averaged, keeping RADADC_EXTRA_BITS more bits. The readings
+ * add up until the temperature thread takes their mean, so one value
+ * covers a whole TEMPERATURE_SAMPLE_INTERVAL however fast the ADC runs.
+ */
+static void radadc_end_callback(ADCDriver *adcp, adcsample_t *buffer, size_t n)
+{
+  uint8_t channels = adcp->grpp->num_channels;
+  RadAdcFilter *f = &filters[radadc_first_channel(adcp)];
+
+  for (uint8_t j = 0; j < channels; j++, f++) {
+    uint32_t sum = 0;
+    adcsample_t lo = buffer[j], hi = buffer[j];
+    for (size_t k = 0; k < n; k++) {
+      adcsample_t v = buffer[k * channels + j];
+      sum += v;
+      if (v < lo) lo = v;
+      if (v > hi) hi = v;
+    }
+    f->sum += ((sum - lo - hi) << RADADC_EXTRA_BITS) / (n - 2);
+    f->count++;
+  }
+}
+
+/*
+ * The driver stops the conversion on errors, the temperature thread
+ * starts it again. Readings from before are not mixed with new ones.
+ */
+static void radadc_error_callback(ADCDriver *adcp, adcerror_t err)
 {
-  (void)adcp;
   (void)err;
-  has_error++;
-  if (--finishing_count == 0) {
-    chSysLockFromIsr();
-    chSchReadyI(tp);
-    chSysUnlockFromIsr();
+  RadAdcFilter *f = &filters[radadc_first_channel(adcp)];
+  for (uint8_t j = 0; j < adcp->grpp->num_channels; j++, f++) {
+    f->sum = 0;
+    f->count = 0;
+  }
+}
+
+/* Starts the ADCs that are not converting */
+static void radadc_start(void)
+{
+  chSysLock();
+  for (uint8_t i = 0; i < RAD_NUMBER_ADCS; i++) {
+    RadAdcChannel *ch = &radboard.adc.channels[i];
+    if (ch->adc->state == ADC_READY)
+      adcStartConversionI(ch->adc, &ch->group_base, ch->samples, RADADC_BUFFER_DEPTH);
   }
+  chSysUnlock();
+}
+
+/*
+ * Returns the mean of the readings of a channel since the last call, if
+ * there are any.
+ */
+static bool_t radadc_read(uint8_t c, adcsample_t *sample)
+{
+  RadAdcFilter *f = &filters[c];
+  chSysLock();
+  uint32_t sum = f->sum;
+  uint32_t count = f->count;
+  f->sum = 0;
+  f->count = 0;
+  chSysUnlock();
+  if (count == 0)
+    return FALSE;
+
+  *sample = (sum + count / 2) / count;
+  return TRUE;
 }
 
 static msg_t threadTemp(void *arg) {
@@ -75,63 +141,50 @@ static msg_t threadTemp(void *arg) {
   uint8_t i, j, k, c;
   RadAdcChannel *ch;
 
-  tp = chThdSelf();
   chRegSetThreadName("temp");
 
   while (TRUE) {
-    chThdSleepMilliseconds(50);
-
-    finishing_count = RAD_NUMBER_ADCS;
-    has_error = 0;
-
-    chSysLock();
-    for (i = 0; i < RAD_NUMBER_ADCS; i++) {
-      ch = &radboard.adc.channels[i];
-      adcStartConversionI(ch->adc, &ch->group_base, ch->samples, ch->group_base.num_channels);
-    }
-    chSchGoSleepS(THD_STATE_SUSPENDED);
-
-    if (has_error || finishing_count)
-      continue;
+    chThdSleep(TEMPERATURE_SAMPLE_INTERVAL);
+    radadc_start();
 
     c = 0;
     for (i = 0; i < RAD_NUMBER_ADCS; i++) {
       ch = &radboard.adc.channels[i];
       for (j = 0; j < ch->group_base.num_channels; j++, c++) {
+        adcsample_t sample;
+        if (!radadc_read(c, &sample))
+          continue;
         for (k = 0; k < RAD_NUMBER_TEMPERATURES; k++) {
           RadTemp *cht = &machine.temperature.devices[k];
           if (cht->adc_id == c && cht->converter) {
-            RadTempState *s = &temperatures[k];
-            adcsample_t sample = ch->samples[j];
-            float pv = cht->converter(sample, ch->resolution);
-            chSysLock();
-            s->pv = pv;
-            s->raw = sample;
-            float sv = s->sv;
-            if (!s->target_reached_at)
-              if ((s->is_heating && s->pv >= sv) ||
-                  (!s->is_heating && s->pv <= sv))
-                s->target_reached_at = chTimeNow();
-            chSysUnlock();
-            temperature_pid_loop(k, sv, pv);
+            float pv = cht->converter(sample, ch->resolution + RADADC_EXTRA_BITS);
+            bool_t valid = temperature_guard_check(k, pv);
+            float sv = temperature_update(k, pv, sample, valid);
+            if (valid)
+              temperature_pid_loop(k, sv, pv);
           }
         }
       }
     }
+    temperature_history_record();
   }
   return 0;
 }
 
 void temperature_core_init(void)
 {
-  uint8_t i;
+  uint8_t i, channels = 0;
   RadAdcChannel *ch;
 
   for (i = 0; i < RAD_NUMBER_ADCS; i++) {
     ch = &radboard.adc.channels[i];
+    ch->group_base.circular = TRUE;
     ch->group_base.end_cb = radadc_end_callback;
     ch->group_base.error_cb = radadc_error_callback;
+    channels += ch->group_base.num_channels;
   }
+  chDbgAssert(channels <= RADADC_MAX_CHANNELS,
+      "temperature_core_init(), #1", "too many ADC channels");
 }
 
 /** @} */
@@ -36,50 +36,69 @@
 /* Local variables and types.                                                */
 /*===========================================================================*/
 
-static WORKING_AREA(waTemp, 64);
+static WORKING_AREA(waTemp, 512);
+
+static RadTempPlant plants[RAD_NUMBER_TEMPERATURES];
+static systime_t plant_time;
+
+static const RadTempPlantConfig plant_hotend = TEMP_PLANT_HOTEND;
+static const RadTempPlantConfig plant_bed = TEMP_PLANT_BED;
 
 /*===========================================================================*/
 /* Local functions.                                                          */
 /*===========================================================================*/
 
+static const RadTempPlantConfig* plant_config(uint8_t temp_id)
+{
+  if (machine.temperature.devices[temp_id].plant)
+    return machine.temperature.devices[temp_id].plant;
+  for (uint8_t i = 0; i < machine.heated_bed.count; i++)
+    if (machine.heated_bed.devices[i].temp_id == temp_id)
+      return &plant_bed;
+  return &plant_hotend;
+}
+
+/*
+ * Steps every plant by the time that has passed, with the extrusion and
+ * fan of its heater, and feeds the readings through the same checks and
+ * control as real ones. Sensors without a heater sit at their ambient
+ * temperature.
+ */
 static msg_t threadTemp(void *arg) {
   (void)arg;
-  uint8_t i, j, k, c;
+  uint8_t k;
 
   chRegSetThreadName("temp");
 
   while (TRUE) {
-    chThdSleepMilliseconds(50);
+    chThdSleep(TEMPERATURE_SAMPLE_INTERVAL);
+    systime_t now = chTimeNow();
+    float dt = (float) (systime_t) (now - plant_time) / CH_FREQUENCY;
+    plant_time = now;
 
     for (k = 0; k < RAD_NUMBER_TEMPERATURES; k++) {
       RadTemp *cht = &machine.temperature.devices[k];
-      if (cht->heating_pwm_id >= 0) {
-        RadTempState *s = &temperatures[k];
-
-        chSysLock();
-        // Simulated output and temperature
-        uint8_t duty = outputGet(cht->heating_pwm_id);
-        if (65535 - (uint16_t) duty >= s->raw) {
-          s->raw += duty;
-        } else {
-          s->raw = 65535;
-        }
-        s->raw = s->raw * 0.99;
-        s->pv = s->raw / (float)(255 * 100 / 1) * 300;
-        float sv = s->sv;
-        if (!s->target_reached_at)
-          if ((s->is_heating && s->pv >= sv) ||
-              (!s->is_heating && s->pv <= sv))
-            s->target_reached_at = chTimeNow();
-        chSysUnlock();
-        temperature_pid_loop(k, sv, s->pv);
-      }
+      uint8_t duty = cht->heating_pwm_id >= 0 ? outputGet(cht->heating_pwm_id) : 0;
+      uint8_t fan = cht->cooling_pwm_id >= 0 ? outputGet(cht->cooling_pwm_id) : 0;
+      float flow = 0;
+      for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++)
+        if (machine.extruder.devices[i].temp_id == k)
+          flow += stepperGetExtrusionRate(i);
+      float pv = tempPlantStep(&plants[k], plant_config(k), duty, flow, fan, dt);
+      bool_t valid = temperature_guard_check(k, pv);
+      float sv = temperature_update(k, pv, 0, valid);
+      if (valid)
+        temperature_pid_loop(k, sv, pv);
     }
+    temperature_history_record();
   }
   return 0;
 }
 
 void temperature_core_init()
 {
+  for (uint8_t k = 0; k < RAD_NUMBER_TEMPERATURES; k++)
+    tempPlantInit(&plants[k], plant_config(k), k + 1);
+  plant_time = chTimeNow();
 }
 /** @} */
@@ -0,0 +1,151 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * @file    temperature_guard.h
+ * @brief   Temperature thermal protection
+ *
+ * Checks on every sample that a heater's temperature follows its output,
+ * so a sensor that falls off or breaks cannot leave the heater on. The
+ * printer is estopped on a fault.
+ *
+ * @addtogroup TEMPERATURE
+ * @{
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "rad.h"
+
+#include "temperature.h"
+
+/*===========================================================================*/
+/* Local variables and types.                                                */
+/*===========================================================================*/
+
+#define TEMPERATURE_GUARD_MAX_TEMP            275
+#define TEMPERATURE_GUARD_MIN_TEMP            0
+#define TEMPERATURE_GUARD_HEATING_PERIOD      S2ST(20)
+#define TEMPERATURE_GUARD_HEATING_RISE        2
+#define TEMPERATURE_GUARD_HYSTERESIS          4
+#define TEMPERATURE_GUARD_HYSTERESIS_PERIOD   S2ST(40)
+/* Bad readings in a row before a sensor is faulty */
+#define TEMPERATURE_GUARD_SENSOR_SAMPLES      3
+
+#define GUARD_VALUE(cht, name, dflt) \
+  ((cht)->guard.name ? (cht)->guard.name : (dflt))
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+/*
+ * Checks a new reading of a heater. Returns FALSE if it must not be used
+ * for control, in which case the heater is off.
+ *
+ * A heater is watched from the time its target is set. While heating
+ * far from the target, a window restarts each time the temperature has
+ * risen enough, and a fault is raised when a window runs out. Once the
+ * target has been reached, the time spent below the hysteresis band is
+ * limited instead. Autotune does its own checks.
+ */
+static bool_t temperature_guard_check(uint8_t temp_id, float pv)
+{
+  RadTemp* cht = &machine.temperature.devices[temp_id];
+  RadTempGuardState* g = &guard_states[temp_id];
+  RadTempState* t = &temperatures[temp_id];
+
+  if (cht->heating_pwm_id < 0 || printerIsEstopped())
+  {
+    g->sensor_faults = 0;
+    return TRUE;
+  }
+
+  if (pv >= TEMPERATURE_UNKNOWN_VALUE ||
+      pv < GUARD_VALUE(cht, min_temp, TEMPERATURE_GUARD_MIN_TEMP))
+  {
+    outputSet(cht->heating_pwm_id, 0);
+    if (++g->sensor_faults >= TEMPERATURE_GUARD_SENSOR_SAMPLES)
+      printerEstopFormatted(L_TEMPERATURE_SENSOR_FAULT, temp_id);
+    return FALSE;
+  }
+  g->sensor_faults = 0;
+
+  if (pv > GUARD_VALUE(cht, max_temp, TEMPERATURE_GUARD_MAX_TEMP))
+  {
+    printerEstopFormatted(L_TEMPERATURE_OVERHEATED, temp_id);
+    return FALSE;
+  }
+
+  chSysLock();
+  float sv = t->sv;
+  bool_t is_heating = t->is_heating;
+  bool_t reached = t->target_reached_at != 0;
+  bool_t tuning = pid_states[temp_id].tuning_cycle_remains > 0;
+  chSysUnlock();
+
+  systime_t now = chTimeNow();
+  if (sv != g->sv)
+  {
+    g->sv = sv;
+    g->since = 0;
+  }
+  if (sv <= 0 || tuning)
+  {
+    g->since = 0;
+    return TRUE;
+  }
+
+  float hysteresis = GUARD_VALUE(cht, hysteresis, TEMPERATURE_GUARD_HYSTERESIS);
+  if (reached)
+  {
+    if (pv >= sv - hysteresis)
+      g->since = 0;
+    else if (!g->since)
+      g->since = now;
+    else if (now - g->since > GUARD_VALUE(cht, hysteresis_period,
+                                          TEMPERATURE_GUARD_HYSTERESIS_PERIOD))
+    {
+      printerEstopFormatted(L_TEMPERATURE_RUNAWAY, temp_id);
+      return FALSE;
+    }
+  }
+  else if (is_heating)
+  {
+    float rise = GUARD_VALUE(cht, heating_rise, TEMPERATURE_GUARD_HEATING_RISE);
+    // Close to the target the rise slows down, the band takes over there
+    if (pv >= sv - rise - hysteresis)
+      g->since = 0;
+    else if (!g->since || pv >= g->mark + rise)
+    {
+      g->since = now;
+      g->mark = pv;
+    }
+    else if (now - g->since > GUARD_VALUE(cht, heating_period,
+                                          TEMPERATURE_GUARD_HEATING_PERIOD))
+    {
+      printerEstopFormatted(L_TEMPERATURE_NOT_HEATING, temp_id);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+/** @} */
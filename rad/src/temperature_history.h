@@ -0,0 +1,78 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/**
+ * @file    temperature_history.h
+ * @brief   Temperature history
+ *
+ * Every TEMPERATURE_HISTORY_INTERVAL the temperature thread appends the
+ * readings of all sensors to a ring. Each entry has a sequence number,
+ * counted from boot, so readers fetch only what is new since their last
+ * read.
+ *
+ * @addtogroup TEMPERATURE
+ * @{
+ */
+
+#include "ch.h"
+#include "hal.h"
+#include "rad.h"
+
+#include "temperature.h"
+
+/*===========================================================================*/
+/* Local variables and types.                                                */
+/*===========================================================================*/
+
+static int16_t history[TEMPERATURE_HISTORY_SIZE][RAD_NUMBER_TEMPERATURES];
+/* Sequence number of the next entry */
+static uint32_t history_seq;
+static systime_t history_time;
+
+/*===========================================================================*/
+/* Local functions.                                                          */
+/*===========================================================================*/
+
+/*
+ * Appends the current readings once an interval has passed. The thread
+ * wakes up a little late at times, so the next entry is due one interval
+ * after this one was due, not after now.
+ */
+static void temperature_history_record(void)
+{
+  systime_t now = chTimeNow();
+  if (now - history_time < TEMPERATURE_HISTORY_INTERVAL)
+    return;
+  history_time += TEMPERATURE_HISTORY_INTERVAL;
+  if (now - history_time >= TEMPERATURE_HISTORY_INTERVAL)
+    history_time = now;
+
+  int16_t* entry = history[history_seq % TEMPERATURE_HISTORY_SIZE];
+  chSysLock();
+  for (uint8_t i = 0; i < RAD_NUMBER_TEMPERATURES; i++)
+  {
+    float pv = temperatures[i].pv * 10;
+    entry[i] = pv > INT16_MAX ? INT16_MAX : pv < INT16_MIN ? INT16_MIN : (int16_t) pv;
+  }
+  history_seq++;
+  chSysUnlock();
+}
+
+/** @} */
@@ -36,146 +36,204 @@
 /* Local variables and types.                                                */
 /*===========================================================================*/
 
+#define PID_OUTPUT_LIMIT    255
+/* Extra fraction bits of ki, which is tiny per tick */
+#define PID_KI_SHIFT        16
+/* Time constant of the derivative filter */
+#define PID_D_FILTER        S2ST(1)
+
 /*===========================================================================*/
 /* Local functions.                                                          */
 /*===========================================================================*/
 
-void temperatureAutoTune(uint8_t temp_id, float target, uint8_t total_cycles)
+/*
+ * Sets the gains and their fixed point forms: kp in Q16, ki per tick with
+ * PID_KI_SHIFT more bits and kd in Q8.
+ * Called with the system locked, or before the temperature thread runs.
+ */
+static void temperature_pid_configure(RadTempPidState* state, const RadTempConfig* config)
 {
-  if (temp_id >= RAD_NUMBER_TEMPERATURES)
-    return;
-
-  if (printerIsEstopped())
-  {
-    return;
-  }
-
-  RadTemp* cht = &machine.temperature.devices[temp_id];
-  if (cht->heating_pwm_id < 0)
-    return;
-
-  float pv = 0.0;
-  float pvHigh = 0, pvLow = 10000;
-  systime_t tHigh = 0, tLow = 0;
-  bool_t heating = FALSE;
+  state->config = *config;
+  state->kp = config->Kp * 65536;
+  state->ki = config->Ki * ((float) (1LL << (16 + PID_KI_SHIFT)) / CH_FREQUENCY);
+  state->kd = config->Kd * 256;
+}
 
+/*
+ * Ends an autotune. Gains found are kept, otherwise the old ones are put
+ * back.
+ */
+static void temperature_autotune_end(uint8_t temp_id, bool_t done)
+{
   RadTempPidState* state = &pid_states[temp_id];
-  RadTempPidState backup_state = *state;
+  outputSet(machine.temperature.devices[temp_id].heating_pwm_id, 0);
   chSysLock();
-  state->tuning_cycle_remains = total_cycles;
+  if (!done)
+    temperature_pid_configure(state, &state->tune.backup);
+  state->tuning_cycle_remains = 0;
+  state->running = FALSE;
   chSysUnlock();
-  total_cycles = 0;
+}
 
-  int32_t bias, d;
-  float Ku, Tu;
+/*
+ * Clamps a relay output to the range of the heater PWM.
+ */
+static int32_t temperature_autotune_output(int32_t output)
+{
+  if (output < 0)
+    return 0;
+  if (output > 255)
+    return 255;
+  return output;
+}
 
+/*
+ * One step of a relay autotune, run by the temperature thread on every
+ * sample of a heater being tuned. The output switches between bias + d
+ * and bias - d each time pv crosses the target, and the gains come from
+ * the period and amplitude of the oscillation.
+ */
+static void temperature_autotune_step(uint8_t temp_id, float pv)
+{
+  RadTemp* cht = &machine.temperature.devices[temp_id];
+  RadTempPidState* state = &pid_states[temp_id];
+  RadTempTuneState* tune = &state->tune;
   systime_t now = chTimeNow();
-  systime_t t1 = now - S2ST(10);
-  systime_t t2 = now;
-
   // TODO: Max output limit
   int32_t limit = 255;
-  bias = d = limit / 2;
 
-  outputSet(cht->heating_pwm_id, 0);
-  while (1)
+  if (printerIsEstopped())
   {
-    pv = temperatureGet(temp_id).pv;
-    pvHigh = fmax(pvHigh, pv);
-    pvLow = fmin(pvLow, pv);
+    temperature_autotune_end(temp_id, FALSE);
+    return;
+  }
 
-    if (heating && pv > target)
+  tune->pv_high = fmax(tune->pv_high, pv);
+  tune->pv_low = fmin(tune->pv_low, pv);
+
+  if (tune->heating && pv > tune->target)
+  {
+    if (now - tune->t2 > S2ST(5))
     {
-      if (chTimeNow() - t2 > S2ST(5))
-      {
-        RAD_DEBUG_PRINTF("Autotune: cooling: bias=%d, d=%d\n", bias, d);
-        heating = FALSE;
-        outputSet(cht->heating_pwm_id, (bias - d) / 2);
-        t1 = chTimeNow();
-        tHigh = t1 - t2;
-        pvHigh = pv;
-      }
+      RAD_DEBUG_PRINTF("Autotune %d: cooling: bias=%d, d=%d\n", temp_id, tune->bias, tune->d);
+      tune->heating = FALSE;
+      outputSet(cht->heating_pwm_id, temperature_autotune_output(tune->bias - tune->d));
+      tune->t1 = now;
+      tune->t_high = tune->t1 - tune->t2;
+      tune->pv_high = pv;
     }
-    if (!heating && pv < target)
+  }
+  if (!tune->heating && pv < tune->target)
+  {
+    if (now - tune->t1 > S2ST(5))
     {
-      if (chTimeNow() - t1 > S2ST(5))
+      tune->heating = TRUE;
+      tune->t2 = now;
+      tune->t_low = tune->t2 - tune->t1;
+      // The first cycle is the warm up from ambient, keep it out of the bias
+      if (tune->cycles > 1)
       {
-        heating = TRUE;
-        t2 = chTimeNow();
-        tLow = t2 - t1;
-        if (total_cycles > 0)
+        tune->bias += (tune->d * (int32_t) (tune->t_high - tune->t_low)) /
+            (int32_t) (tune->t_low + tune->t_high);
+        if (tune->bias < 20) {
+          tune->bias = 20;
+        }
+        else if (tune->bias > limit - 20) {
+          tune->bias = limit - 20;
+        }
+        tune->d = (tune->bias > limit / 2) ? limit - 1 - tune->bias : tune->bias;
+
+        if (tune->cycles > 2)
         {
-          bias += (d*(tHigh - tLow))/(tLow + tHigh);
-          if (bias < 20) {
-            bias = 20;
-          }
-          else if (bias > limit - 20) {
-            bias = limit - 20;
-          }
-          d = (bias > limit / 2) ? limit - 1 - bias : bias;
-
-          if (total_cycles > 2)
-          {
-            Ku = (4.0 * d) / (3.14159 * (pvHigh-pvLow)/2.0);
-            Tu = ((float)(tLow + tHigh) / CH_FREQUENCY);
-            chSysLock();
-            state->config.Kp = 0.6*Ku;
-            state->config.Ki = 2*state->config.Kp/Tu;
-            state->config.Kd = state->config.Kp*Tu/8;
-            chSysUnlock();
-          }
+          float Ku = (4.0 * tune->d) / (3.14159 * (tune->pv_high - tune->pv_low) / 2.0);
+          float Tu = ((float) (tune->t_low + tune->t_high) / CH_FREQUENCY);
+          RadTempConfig config = state->config;
+          config.Kp = 0.6*Ku;
+          config.Ki = 2*config.Kp/Tu;
+          config.Kd = config.Kp*Tu/8;
+          chSysLock();
+          temperature_pid_configure(state, &config);
+          chSysUnlock();
         }
+      }
 
-        RAD_DEBUG_PRINTF("Autotune: heating: bias=%d, d=%d\n", bias, d);
-        outputSet(cht->heating_pwm_id, (bias + d) / 2);
-        total_cycles++;
-        pvLow = pv;
+      RAD_DEBUG_PRINTF("Autotune %d: heating: bias=%d, d=%d\n", temp_id, tune->bias, tune->d);
+      outputSet(cht->heating_pwm_id, temperature_autotune_output(tune->bias + tune->d));
+      tune->cycles++;
+      tune->pv_low = pv;
 
-        chSysLock();
-        state->tuning_cycle_remains--;
-        chSysUnlock();
-      }
+      chSysLock();
+      state->tuning_cycle_remains--;
+      chSysUnlock();
     }
+  }
 
-    if (pv > target + 20)
-    {
-      printerEstop(L_TEMPERATURE_AUTOTUNE_OVERHEATED);
-      break;
-    }
+  if (pv > tune->target + 20)
+  {
+    printerEstop(L_TEMPERATURE_AUTOTUNE_OVERHEATED);
+    temperature_autotune_end(temp_id, FALSE);
+    return;
+  }
 
-    if (chTimeNow() - now > S2ST(2))
-    {
-      RAD_DEBUG_PRINTF("Autotune: pwm=%d, pv=%.1f, target=%.1f, output=%d\n",
-          cht->heating_pwm_id,
-          pv, target,
-          outputGet(cht->heating_pwm_id));
-      now = chTimeNow();
-    }
+  if (now - tune->last_report > S2ST(2))
+  {
+    RAD_DEBUG_PRINTF("Autotune %d: pwm=%d, pv=%.1f, target=%.1f, output=%d\n",
+        temp_id, cht->heating_pwm_id, pv, tune->target,
+        outputGet(cht->heating_pwm_id));
+    tune->last_report = now;
+  }
 
-    if(((chTimeNow() - t1) + (chTimeNow() - t2)) > S2ST(1200)) {
-      printerEstop(L_TEMPERATURE_AUTOTUNE_TIMEOUT);
-      break;
-    }
+  if (((now - tune->t1) + (now - tune->t2)) > S2ST(1200)) {
+    printerEstop(L_TEMPERATURE_AUTOTUNE_TIMEOUT);
+    temperature_autotune_end(temp_id, FALSE);
+    return;
+  }
 
-    if (state->tuning_cycle_remains == 0)
-    {
-      RAD_DEBUG_PRINTF("Autotune: done: Kp=%f, Ki=%f, Kd=%f\n", state->config.Kp, state->config.Ki, state->config.Kd);
-      outputSet(cht->heating_pwm_id, 0);
-      return;
-    }
+  if (state->tuning_cycle_remains == 0)
+  {
+    RAD_DEBUG_PRINTF("Autotune %d: done: Kp=%f, Ki=%f, Kd=%f\n", temp_id,
+        state->config.Kp, state->config.Ki, state->config.Kd);
+    temperature_autotune_end(temp_id, TRUE);
+  }
+}
 
-    if (printerIsEstopped())
-    {
-      break;
-    }
-    chThdSleepMilliseconds(50);
-  } // while(1)
+/*
+ * Returns the duty in Q16 that the planned extrusion and the cooling fan
+ * of a heater take away at the target, to be put in before the
+ * temperature drops.
+ */
+static int32_t temperature_pid_feed_forward(uint8_t temp_id, float sv)
+{
+  RadTemp* cht = &machine.temperature.devices[temp_id];
+  const RadTempConfig* config = &pid_states[temp_id].config;
+  float duty = 0;
 
-  chSysLock();
-  *state = backup_state;
-  chSysUnlock();
+  if (config->Kf_flow > 0)
+  {
+    float rate = 0;
+    for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++)
+      if (machine.extruder.devices[i].temp_id == temp_id)
+        rate += stepperGetExtrusionRate(i);
+    if (rate > 0)
+      duty += config->Kf_flow * rate;
+  }
+  if (config->Kf_fan > 0 && cht->cooling_pwm_id >= 0)
+    duty += config->Kf_fan * outputGet(cht->cooling_pwm_id) / 255;
+
+  duty *= sv - TEMPERATURE_AMBIENT;
+  if (duty <= 0)
+    return 0;
+  return duty >= PID_OUTPUT_LIMIT ? PID_OUTPUT_LIMIT << 16 : (int32_t) (duty * 65536);
 }
 
+/*
+ * Runs the PID of a heater once its control interval has passed since
+ * the last run. dt is measured, so the gains do not depend on the rate.
+ * The derivative is taken on the measurement, and the integral stops
+ * growing while the output is saturated in the same direction. It may go
+ * negative to hold a setpoint that needs less than the proportional term.
+ * Feed-forward is added on top and left for the integral to correct.
+ */
 static void temperature_pid_loop(uint8_t temp_id, float sv, float pv)
 {
   RadTemp* cht = &machine.temperature.devices[temp_id];
@@ -184,23 +242,60 @@ static void temperature_pid_loop(uint8_t temp_id, float sv, float pv)
 
   RadTempPidState* state = &pid_states[temp_id];
   if (state->tuning_cycle_remains > 0)
+  {
+    temperature_autotune_step(temp_id, pv);
     return;
+  }
 
-  int32_t limit = 255;
+  systime_t now = chTimeNow();
+  int32_t pv_q8 = pv * 256;
+  if (sv <= 0)
+  {
+    // Off, start again from nothing when heating next
+    state->running = FALSE;
+    outputSet(cht->heating_pwm_id, 0);
+    return;
+  }
+  if (!state->running)
+  {
+    state->running = TRUE;
+    state->i_term = 0;
+    state->d_term = 0;
+    state->last_pv = pv_q8;
+    state->last_time = now;
+  }
+
+  systime_t dt = now - state->last_time;
+  if (dt < cht->control_interval)
+    return;
+  if (dt == 0)
+    dt = 1;
+  state->last_time = now;
+
+  const int32_t limit = PID_OUTPUT_LIMIT << 16;
+  int32_t error = (int32_t) (sv * 256) - pv_q8;
+
+  int32_t p_term = ((int64_t) state->kp * error) >> 8;
+
+  // A large Kd over a fast rise can exceed 32 bits, more than full output
+  // either way does not change the result
+  int64_t d_raw = (int64_t) state->kd * CH_FREQUENCY * (pv_q8 - state->last_pv) / (int32_t) dt;
+  d_raw = d_raw > limit ? limit : d_raw < -limit ? -limit : d_raw;
+  state->d_term += (int64_t) (d_raw - state->d_term) * dt / (PID_D_FILTER + dt);
+  state->last_pv = pv_q8;
+
+  int32_t f_term = temperature_pid_feed_forward(temp_id, sv);
+  int32_t output = p_term + state->i_term - state->d_term + f_term;
+  if (!(output >= limit && error > 0) && !(output <= 0 && error < 0))
+  {
+    int64_t i_term = state->i_term +
+        (((int64_t) state->ki * error * (int32_t) dt) >> (8 + PID_KI_SHIFT));
+    state->i_term = i_term > limit ? limit : i_term < -limit ? -limit : i_term;
+    output = p_term + state->i_term - state->d_term + f_term;
+  }
 
-  state->error = sv - pv;
-  float pTerm = state->config.Kp * state->error;
-  state->i_error += state->error;
-  if (state->config.Ki > 0)
-    state->i_error = fmax(fmin(state->i_error, limit / state->config.Ki), 0);
-  // TODO: i_error minimum is 0? or negative?
-  float iTerm = state->config.Ki * state->i_error;
-  float dTerm = state->d_state =
-      state->config.Kd * (pv - state->d_pv) * 0.05 + state->d_state * 0.95;
-  state->d_pv = pv;
-
-  uint8_t output = fmin(fmax(pTerm + iTerm - dTerm, 0), limit);
-  outputSet(cht->heating_pwm_id, output);
+  output = output < 0 ? 0 : output > limit ? limit : output;
+  outputSet(cht->heating_pwm_id, output >> 16);
 }
 
 /** @} */
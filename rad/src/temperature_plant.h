@@ -0,0 +1,141 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Simulated heater
+ *
+ * Stands in for a heater and its sensor when there is no ADC, and in
+ * tools/tempsim. Shared with the host tool, keep it free of firmware
+ * headers.
+ *
+ * Two masses: the heater block gains the heater power, delayed by the
+ * dead time, and loses heat to the ambient air, to the fan and to the
+ * filament going through it. The sensor follows the
+ * block with a first order lag, and its reading carries uniform noise.
+ * The model is stepped in fixed steps of TEMP_PLANT_STEP seconds of
+ * simulated time, whatever the time given to each call.
+ */
+
+#ifndef _TEMPERATURE_PLANT_H_
+#define _TEMPERATURE_PLANT_H_
+
+#include <stdint.h>
+
+/* Integration step, seconds */
+#define TEMP_PLANT_STEP         0.02f
+/* Longest dead time is TEMP_PLANT_DELAY_STEPS * TEMP_PLANT_STEP */
+#define TEMP_PLANT_DELAY_STEPS  512
+
+typedef struct {
+  float power;        /* W at full duty */
+  float capacity;     /* J/K of the heater block */
+  float loss;         /* W/K from the block to the ambient air */
+  float sensor_tau;   /* s, time constant of the sensor */
+  float dead_time;    /* s, before the heater power reaches the block */
+  float ambient;      /* degC */
+  float noise;        /* degC, largest error of a reading */
+  float flow_heat;    /* J/K taken by each mm of filament extruded */
+  float fan_loss;     /* W/K more to the ambient air at full fan */
+} RadTempPlantConfig;
+
+/*
+ * A 40W cartridge in an aluminium block, tops out around 350 degC.
+ * 1.75mm PLA, and a part cooling fan that reaches the block.
+ */
+#define TEMP_PLANT_HOTEND \
+  { .power = 40, .capacity = 12, .loss = 0.12f, .sensor_tau = 2, \
+    .dead_time = 1, .ambient = 25, .noise = 0.2f, \
+    .flow_heat = 0.0054f, .fan_loss = 0.05f }
+
+/* A 200W bed on 3mm aluminium, tops out around 150 degC */
+#define TEMP_PLANT_BED \
+  { .power = 200, .capacity = 700, .loss = 1.6f, .sensor_tau = 8, \
+    .dead_time = 4, .ambient = 25, .noise = 0.1f }
+
+typedef struct {
+  float     block;
+  float     sensor;
+  float     pending;
+  float     delay[TEMP_PLANT_DELAY_STEPS];
+  uint16_t  delay_pos;
+  uint32_t  seed;
+} RadTempPlant;
+
+/*
+ * Starts a plant cold. Plants with different seeds get different noise.
+ */
+static inline void tempPlantInit(RadTempPlant* plant,
+                                 const RadTempPlantConfig* config,
+                                 uint32_t seed)
+{
+  uint16_t i;
+  plant->block = plant->sensor = config->ambient;
+  plant->pending = 0;
+  for (i = 0; i < TEMP_PLANT_DELAY_STEPS; i++)
+    plant->delay[i] = 0;
+  plant->delay_pos = 0;
+  plant->seed = seed ? seed : 1;
+}
+
+/*
+ * Runs the plant for dt seconds at a duty of 0-255, extruding flow mm/s
+ * of filament with the fan at 0-255, and returns the sensor reading.
+ */
+static inline float tempPlantStep(RadTempPlant* plant,
+                                  const RadTempPlantConfig* config,
+                                  uint8_t duty, float flow, uint8_t fan,
+                                  float dt)
+{
+  float loss = config->loss + config->fan_loss * fan / 255;
+  if (flow > 0)
+    loss += config->flow_heat * flow;
+
+  uint16_t delay = config->dead_time / TEMP_PLANT_STEP;
+  if (delay >= TEMP_PLANT_DELAY_STEPS)
+    delay = TEMP_PLANT_DELAY_STEPS - 1;
+
+  plant->pending += dt;
+  while (plant->pending >= TEMP_PLANT_STEP)
+  {
+    plant->pending -= TEMP_PLANT_STEP;
+
+    // The power put in now comes out delay steps later
+    plant->delay[plant->delay_pos] = config->power * duty / 255;
+    uint16_t out = (plant->delay_pos + TEMP_PLANT_DELAY_STEPS - delay) %
+        TEMP_PLANT_DELAY_STEPS;
+    plant->delay_pos = (plant->delay_pos + 1) % TEMP_PLANT_DELAY_STEPS;
+
+    float heat = plant->delay[out] - (plant->block - config->ambient) * loss;
+    plant->block += heat * TEMP_PLANT_STEP / config->capacity;
+    if (config->sensor_tau > TEMP_PLANT_STEP)
+      plant->sensor += (plant->block - plant->sensor) * TEMP_PLANT_STEP / config->sensor_tau;
+    else
+      plant->sensor = plant->block;
+  }
+
+  // xorshift32, only needs to look random
+  plant->seed ^= plant->seed << 13;
+  plant->seed ^= plant->seed >> 17;
+  plant->seed ^= plant->seed << 5;
+  float noise = ((float) (plant->seed >> 8) / (1 << 24) * 2 - 1) * config->noise;
+  return plant->sensor + noise;
+}
+
+#endif
@@ -31,6 +31,7 @@
 #include "rad.h"
 
 #include "ui.h"
+#include <stdlib.h>
 
 #if HAL_USE_GFX
 #include "gfx.h"
@@ -147,9 +148,19 @@ typedef struct {
       struct {
         uint32_t total;
         uint32_t processed;
+        /* Read-ahead buffer fill, in tenths */
+        uint8_t prefetch_fill;
+        bool_t prefetch_stalled;
       } progress;
+      struct {
+        uint32_t current;
+        /* 0 unless the file has a layer table */
+        uint32_t total;
+      } layer;
       char* status_icon;
       int16_t time_spent;
+      /* Minutes, -1 unless the print reports it with M73 */
+      int16_t time_left;
       DashboardAxis axes[3];
       RadStorageHost storage_state;
       DashboardTempData temps[RAD_NUMBER_TEMPERATURES];
@@ -164,7 +175,7 @@ typedef struct {
         } standard;
         struct {
           UiMenuItem item;
-          int16_t directory_opened;
+          int16_t last_index;
         } print;
       };
       menu_get_t get_cb;
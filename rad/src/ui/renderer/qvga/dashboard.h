@@ -239,7 +239,7 @@ static void ui_dashboard_renderer(void) {
     {
       gdispFillStringBox(
           10, 63,
-          160, 28,
+          100, 28,
           uiState.filename, fontText, Fg, Bg, justifyLeft);
     } else
     {
@@ -257,15 +257,40 @@ static void ui_dashboard_renderer(void) {
 
       coord_t w = (157 * uiState.dashboard.progress.processed / uiState.dashboard.progress.total) + 1;
       gdispFillArea(10 + 1, 96 + 1, w, 19, HighlightBg);
+
+      // Read-ahead buffer fill, red once the card could not keep up
+      w = 159 * uiState.dashboard.progress.prefetch_fill / 10;
+      gdispFillArea(10 + 1, 118, w, 3,
+          uiState.dashboard.progress.prefetch_stalled ? HighlightBg2 : AuxBorder);
+      gdispFillArea(10 + 1 + w, 118, 159 - w, 3, Bg);
+    }
+
+    if ((uiState.changed_parts & DASHBOARD_Layer))
+    {
+      char text[16] = "";
+      if (uiState.dashboard.layer.total > 0)
+        snprintf(text, sizeof(text), "%d/%d",
+            (int) uiState.dashboard.layer.current, (int) uiState.dashboard.layer.total);
+      else if (uiState.dashboard.layer.current > 0)
+        snprintf(text, sizeof(text), "L%d", (int) uiState.dashboard.layer.current);
+      gdispFillStringBox(
+          110, 63,
+          60, 28,
+          text, fontSmall, Fg, Bg, justifyRight);
     }
   }
 
   if ((uiState.changed_parts & DASHBOARD_TimeSpent))
   {
-    char text[10] = "----";
-    if (uiState.dashboard.time_spent >= 0)
+    char text[20] = "----";
+    if (uiState.dashboard.time_spent >= 0 && uiState.dashboard.time_left >= 0)
+    {
+      snprintf(text, sizeof(text), "%d:%02d -%d:%02d",
+          uiState.dashboard.time_spent / 60, uiState.dashboard.time_spent % 60,
+          uiState.dashboard.time_left / 60, uiState.dashboard.time_left % 60);
+    } else if (uiState.dashboard.time_spent >= 0)
     {
-      snprintf(text, 10, "%dh %dm", uiState.dashboard.time_spent / 60, uiState.dashboard.time_spent % 60);
+      snprintf(text, sizeof(text), "%dh %dm", uiState.dashboard.time_spent / 60, uiState.dashboard.time_spent % 60);
     }
     gdispFillStringBox(
         40, 126,
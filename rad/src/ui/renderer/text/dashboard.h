@@ -54,16 +54,19 @@ static void ui_dashboard_renderer(void) {
   {
     if (uiState.changed_parts & DASHBOARD_TimeSpent)
     {
+      // Time left takes the place of time spent once the print reports it
+      int16_t time = uiState.dashboard.time_left >= 0 ?
+          uiState.dashboard.time_left : uiState.dashboard.time_spent;
       tdispSetCursor(0, 2);
-      tdispDrawChar('T');
-      if (uiState.dashboard.time_spent < 0)
+      tdispDrawChar(uiState.dashboard.time_left >= 0 ? 'R' : 'T');
+      if (time < 0)
       {
         tdispDrawString("--:--");
       } else
       {
-        tdispDrawString(itostr2(uiState.dashboard.time_spent / 60));
+        tdispDrawString(itostr2(time / 60));
         tdispDrawChar(':');
-        tdispDrawString(itostr2(uiState.dashboard.time_spent % 60));
+        tdispDrawString(itostr2(time % 60));
       }
     }
 
@@ -74,6 +77,21 @@ static void ui_dashboard_renderer(void) {
       tdispDrawString(ftostr42(uiState.dashboard.axes[2].pos));
     }
 
+    if ((uiState.changed_parts & DASHBOARD_Layer) && TDISP_COLUMNS >= 20)
+    {
+      tdispSetCursor(15, 2);
+      if (uiState.dashboard.source == PRINTINGSOURCE_Storage &&
+          uiState.dashboard.layer.current > 0)
+      {
+        tdispDrawChar('L');
+        tdispDrawString(itostr3(uiState.dashboard.layer.current > 999 ?
+            999 : uiState.dashboard.layer.current));
+      } else
+      {
+        tdispDrawString("    ");
+      }
+    }
+
     if (uiState.changed_parts & DASHBOARD_StorageState)
     {
       tdispSetCursor(TDISP_COLUMNS - 1, 2);
@@ -80,7 +80,7 @@ static void ui_dashboard_viewmodel_core(void)
     PrintingSource source = printerGetMainSource();
     if (reset || uiState.dashboard.source != source)
     {
-      uiState.changed_parts |= DASHBOARD_Source | DASHBOARD_Progress;
+      uiState.changed_parts |= DASHBOARD_Source | DASHBOARD_Progress | DASHBOARD_Layer;
       uiState.dashboard.source = source;
       if (source == PRINTINGSOURCE_Storage)
         uiState.dashboard.progress.total = dataStorageGetCurrentFileSize();
@@ -92,6 +92,23 @@ static void ui_dashboard_viewmodel_core(void)
         uiState.changed_parts |= DASHBOARD_Progress;
         uiState.dashboard.progress.processed = processed;
       }
+      DataPrefetchStats prefetch;
+      dataPrefetchGetStats(&prefetch);
+      uint8_t prefetch_fill = prefetch.fill * 10 / DATA_PREFETCH_SIZE;
+      if (uiState.dashboard.progress.prefetch_fill != prefetch_fill ||
+          uiState.dashboard.progress.prefetch_stalled != (prefetch.stalls > 0)) {
+        uiState.changed_parts |= DASHBOARD_Progress;
+        uiState.dashboard.progress.prefetch_fill = prefetch_fill;
+        uiState.dashboard.progress.prefetch_stalled = prefetch.stalls > 0;
+      }
+      uint32_t layer = dataStorageGetCurrentLayer();
+      uint32_t layers = dataStorageGetLayerCount();
+      if (uiState.dashboard.layer.current != layer ||
+          uiState.dashboard.layer.total != layers) {
+        uiState.changed_parts |= DASHBOARD_Layer;
+        uiState.dashboard.layer.current = layer;
+        uiState.dashboard.layer.total = layers;
+      }
     }
   }
 
@@ -113,6 +130,15 @@ static void ui_dashboard_viewmodel_core(void)
         uiState.dashboard.time_spent = time_spent;
       }
     }
+
+    int32_t time_left = printerTimeLeft();
+    if (time_left >= 0)
+      time_left = (time_left + 59) / 60;
+    if (uiState.dashboard.time_left != time_left)
+    {
+      uiState.changed_parts |= DASHBOARD_TimeSpent;
+      uiState.dashboard.time_left = time_left;
+    }
   }
 
   {
@@ -35,7 +35,7 @@ static void ui_prepare_do_homing(void* state)
   (void) state;
   PrinterCommand cmd;
   gcodeInitializeCommand(&cmd);
-  cmd.code = 28;
+  cmd.code = GCODE_G28;
   printerPushCommand(PRINTINGSOURCE_Lcd, &cmd);
 }
 
@@ -22,6 +22,110 @@ static void ui_print_viewmodel_core(void);
 
 uint8_t dir_depth = 0;
 
+#ifndef UI_PRINT_CACHE_ENTRIES
+#define UI_PRINT_CACHE_ENTRIES 128
+#endif
+#ifndef UI_PRINT_CACHE_NAMES
+#define UI_PRINT_CACHE_NAMES 1536
+#endif
+#ifndef UI_PRINT_SORTED
+#define UI_PRINT_SORTED TRUE
+#endif
+
+#define UI_PRINT_CACHE_DIRECTORY 0x8000
+
+/*
+ * Listing of the current directory, read once and kept until the
+ * directory or the card changes. Entries that do not fit are left on
+ * the card and read past the cached ones, and the listing stays in
+ * card order.
+ */
+static struct {
+  bool_t valid;
+  bool_t complete;
+  uint8_t mount_version;
+  int16_t count;
+  int16_t cached;
+  uint16_t names_used;
+  /* Offset in names, UI_PRINT_CACHE_DIRECTORY set for directories */
+  uint16_t entries[UI_PRINT_CACHE_ENTRIES];
+  char names[UI_PRINT_CACHE_NAMES];
+} print_cache;
+
+static bool_t ui_print_skip_file(RadFileInfo* file)
+{
+  return strcmp(file->filename, ".") == 0 ||
+      strcmp(file->filename, "..") == 0;
+}
+
+#if UI_PRINT_SORTED
+/* Directories first, then by name ignoring case */
+static int ui_print_compare(const void* a, const void* b)
+{
+  uint16_t ea = *(const uint16_t*) a, eb = *(const uint16_t*) b;
+  if ((ea ^ eb) & UI_PRINT_CACHE_DIRECTORY)
+    return ea & UI_PRINT_CACHE_DIRECTORY ? -1 : 1;
+
+  const char* na = print_cache.names + (ea & ~UI_PRINT_CACHE_DIRECTORY);
+  const char* nb = print_cache.names + (eb & ~UI_PRINT_CACHE_DIRECTORY);
+  for (;; na++, nb++)
+  {
+    char ca = *na >= 'a' && *na <= 'z' ? *na - ('a' - 'A') : *na;
+    char cb = *nb >= 'a' && *nb <= 'z' ? *nb - ('a' - 'A') : *nb;
+    if (ca != cb || ca == 0)
+      return ca - cb;
+  }
+}
+#endif
+
+static void ui_print_load(void)
+{
+  uint8_t mount_version = storageGetMountVersion();
+  if (print_cache.valid && print_cache.mount_version == mount_version)
+    return;
+
+  print_cache.valid = TRUE;
+  print_cache.complete = TRUE;
+  print_cache.mount_version = mount_version;
+  print_cache.count = 0;
+  print_cache.cached = 0;
+  print_cache.names_used = 0;
+
+  RadFileInfo file;
+  storageOpenDir();
+  while (storageFetchFileInfo(&file))
+  {
+    if (ui_print_skip_file(&file))
+      continue;
+    print_cache.count++;
+
+    size_t len = strlen(file.filename) + 1;
+    if (!print_cache.complete ||
+        print_cache.cached == UI_PRINT_CACHE_ENTRIES ||
+        print_cache.names_used + len > UI_PRINT_CACHE_NAMES)
+    {
+      print_cache.complete = FALSE;
+      continue;
+    }
+    memcpy(print_cache.names + print_cache.names_used, file.filename, len);
+    print_cache.entries[print_cache.cached++] = print_cache.names_used |
+        (file.type == FILETYPE_Directory ? UI_PRINT_CACHE_DIRECTORY : 0);
+    print_cache.names_used += len;
+  }
+  storageCloseDir();
+
+#if UI_PRINT_SORTED
+  if (print_cache.complete)
+    qsort(print_cache.entries, print_cache.cached, sizeof(uint16_t),
+        ui_print_compare);
+#endif
+}
+
+static void ui_print_invalidate(void)
+{
+  print_cache.valid = FALSE;
+}
+
 void ui_print_up(void)
 {
   if (dir_depth == 0)
@@ -32,6 +136,7 @@ void ui_print_up(void)
 
   dir_depth--;
   storageChangeDir("..");
+  ui_print_invalidate();
   uiChangePage(ui_print_viewmodel_core);
 }
 
@@ -45,13 +150,14 @@ void ui_print_change_directory(void* filename)
 {
   dir_depth++;
   storageChangeDir((char*)filename);
+  ui_print_invalidate();
   uiChangePage(ui_print_viewmodel_core);
 }
 
 void ui_print_file(void* filename)
 {
-  dataStorageSelect((char*)filename);
-  dataStoragePrintStart();
+  if (dataStorageSelect((char*)filename))
+    dataStoragePrintStart();
   uiChangePage(ui_dashboard_viewmodel);
 }
 
@@ -69,29 +175,42 @@ static const UiMenuItem* ui_print_file_to_menu(RadFileInfo *file)
   return &uiState.menu.print.item;
 }
 
-int16_t ui_print_count(void)
+/*
+ * Reads an entry the cache had no room for, walking the directory.
+ */
+static bool_t ui_print_fetch_uncached(int16_t index, RadFileInfo* file)
 {
-  int16_t i = 0;
-  RadFileInfo file;
+  static char filename[64];
+  bool_t found = FALSE;
 
   storageOpenDir();
-  for (;;)
+  for (int16_t i = 0; i <= index; i++)
   {
-    if (!storageFetchFileInfo(&file))
+    do {
+      found = storageFetchFileInfo(file);
+    } while (found && ui_print_skip_file(file));
+    if (!found)
       break;
-
-    if (!(strcmp(file.filename, ".") == 0 ||
-        strcmp(file.filename, "..") == 0))
-      i++;
   }
-
   storageCloseDir();
-  return (i < 1 ? 1 : i) +
+  if (!found)
+    return FALSE;
+
+  strncpy(filename, file->filename, sizeof(filename) - 1);
+  file->filename = filename;
+  return TRUE;
+}
+
+int16_t ui_print_count(void)
+{
+  ui_print_load();
+  return (print_cache.count < 1 ? 1 : print_cache.count) +
       (ui_menu_shows_back_item() || dir_depth != 0);
 }
 
 const UiMenuItem* ui_print_get(int16_t index)
 {
+  uiState.menu.print.last_index = index;
   if (ui_menu_shows_back_item() || dir_depth != 0)
   {
     if (index == 0)
@@ -107,56 +226,36 @@ const UiMenuItem* ui_print_get(int16_t index)
     index--;
   }
 
-  uiState.menu.print.directory_opened = -1;
-  storageOpenDir();
-
-  RadFileInfo file;
-  for (int16_t i = 0; i <= index; i++)
+  ui_print_load();
+  if (index < 0 || index >= print_cache.count)
   {
-    do {
-      if (!storageFetchFileInfo(&file)) {
-        if (i == 0 && index == 0) {
-          uiState.menu.print.item = (UiMenuItem)
-            {
-                .name = L_UI_PRINT_NO_FILES
-            };
-          return &uiState.menu.print.item;
-        }
-        return NULL;
-      }
-    } while (
-        strcmp(file.filename, ".") == 0 ||
-        strcmp(file.filename, "..") == 0);
+    if (index == 0) {
+      uiState.menu.print.item = (UiMenuItem)
+        {
+            .name = L_UI_PRINT_NO_FILES
+        };
+      return &uiState.menu.print.item;
+    }
+    return NULL;
   }
 
-  return ui_print_file_to_menu(&file);
-}
-
-static const UiMenuItem* ui_print_get_next(void)
-{
-  if (uiState.menu.print.directory_opened >= 0)
+  RadFileInfo file;
+  if (index < print_cache.cached)
+  {
+    uint16_t entry = print_cache.entries[index];
+    file.filename = print_cache.names + (entry & ~UI_PRINT_CACHE_DIRECTORY);
+    file.type = entry & UI_PRINT_CACHE_DIRECTORY ?
+        FILETYPE_Directory : FILETYPE_File;
+  } else if (!ui_print_fetch_uncached(index, &file))
   {
-    uiState.menu.print.directory_opened++;
-    return ui_print_get(uiState.menu.current - uiState.menu.pos + uiState.menu.print.directory_opened);
+    return NULL;
   }
-
-  RadFileInfo file;
-  do {
-    if (!storageFetchFileInfo(&file))
-      return NULL;
-  } while (
-      strcmp(file.filename, ".") == 0 ||
-      strcmp(file.filename, "..") == 0);
-
   return ui_print_file_to_menu(&file);
 }
 
-static void ui_print_close(void)
+static const UiMenuItem* ui_print_get_next(void)
 {
-  if (uiState.menu.print.directory_opened >= 0)
-    return;
-  storageCloseDir();
-  uiState.menu.print.directory_opened = 0;
+  return ui_print_get(uiState.menu.print.last_index + 1);
 }
 
 static void ui_print_viewmodel_core(void) {
@@ -164,12 +263,14 @@ static void ui_print_viewmodel_core(void) {
   uiState.menu.get_cb = ui_print_get;
   uiState.menu.count_cb = ui_print_count;
   uiState.menu.get_next_cb = ui_print_get_next;
-  uiState.menu.close_cb = ui_print_close;
+  uiState.menu.close_cb = NULL;
   uiState.menu.back_cb = dir_depth == 0 ?
       ui_menu_goto_mainmenu :
       ui_print_up;
 }
 
 static void ui_print_viewmodel(void) {
+  // The card may have been written over USB since the last visit
+  ui_print_invalidate();
   ui_print_viewmodel_core();
 }
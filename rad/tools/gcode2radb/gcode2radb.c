@@ -0,0 +1,447 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * gcode2radb - Converts G-code into a pre-compiled print file
+ *
+ * Usage: gcode2radb <input.gcode> <output>
+ *
+ * Comments are dropped the way the firmware filters them, and the words
+ * the firmware reads are stored as numbers, see src/gcode_binary.h. Only
+ * lines the format cannot hold stop the conversion, other mistakes are
+ * left for the firmware to report when printing.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "gcode_binary.h"
+
+/* Same limit as the storage reader, including the terminator */
+#define LINE_LENGTH 128
+/* 32-bit values in a layer entry */
+#define LAYER_WORDS (GCODEBIN_LAYER_SIZE / 4)
+
+typedef struct {
+  uint16_t words;
+  int32_t values[GCODEBIN_WORD_COUNT];
+  uint8_t codes;
+  char code_letters[GCODEBIN_MAX_CODES];
+  uint16_t code_numbers[GCODEBIN_MAX_CODES];
+} Record;
+
+static FILE* out;
+static uint32_t offset;
+
+static uint32_t record_count;
+static uint32_t index_count;
+static uint32_t* index_entries;
+static uint32_t layer_count;
+static int32_t* layer_entries;
+
+/* Machine state for finding the layers, positions are scaled */
+typedef struct {
+  uint32_t modes;
+  int32_t feedrate;
+  int64_t z;
+  int64_t e;
+  /* Record that last moved Z, and the line, E, modes and F before it */
+  uint32_t z_offset;
+  uint32_t z_line;
+  int64_t z_e;
+  uint32_t z_modes;
+  int32_t z_feedrate;
+  int has_layer;
+  int64_t layer_z;
+} Tracker;
+
+static Tracker tracker;
+
+static void fail(unsigned long line, const char* message)
+{
+  if (line)
+    fprintf(stderr, "gcode2radb: line %lu: %s\n", line, message);
+  else
+    fprintf(stderr, "gcode2radb: %s\n", message);
+  exit(1);
+}
+
+static void put(const uint8_t* data, size_t len)
+{
+  if (fwrite(data, 1, len, out) != len)
+    fail(0, "write failed");
+  offset += len;
+}
+
+static uint8_t* put_u16(uint8_t* p, uint16_t v)
+{
+  p[0] = v & 0xFF;
+  p[1] = v >> 8;
+  return p + 2;
+}
+
+static uint8_t* put_u32(uint8_t* p, uint32_t v)
+{
+  p = put_u16(p, v & 0xFFFF);
+  return put_u16(p, v >> 16);
+}
+
+/*
+ * Drops comments and upper-cases the line in place, like
+ * gcodeFilterBlock() with a fresh parse context.
+ */
+static void filter_line(char* line)
+{
+  char* out = line;
+  int paren = 0;
+  for (char* p = line; *p && *p != '\n' && *p != '\r'; p++)
+  {
+    if (paren) {
+      if (*p == ')') paren = 0;
+    } else if (*p == '(') {
+      paren = 1;
+    } else if (*p == ';') {
+      break;
+    } else {
+      *(out++) = (*p >= 'a' && *p <= 'z') ? *p - ('a' - 'A') : *p;
+    }
+  }
+  *out = '\0';
+}
+
+static int32_t to_fixed(double value, int scaled, unsigned long line)
+{
+  // The firmware reads anything but normal numbers as 0
+  if (!isnormal(value))
+    return 0;
+  if (scaled)
+    value = round(value * GCODEBIN_SCALE);
+  else
+    value = trunc(value);
+  if (value < INT32_MIN || value > INT32_MAX)
+    fail(line, "value out of range");
+  return (int32_t) value;
+}
+
+/*
+ * Reads the words of a filtered line. Like the firmware, only the first
+ * of each word counts, and every G and M word is kept.
+ */
+static void parse_line(const char* p, Record* r, unsigned long line)
+{
+  char m_letters[GCODEBIN_MAX_CODES], g_letters[GCODEBIN_MAX_CODES];
+  uint16_t m_numbers[GCODEBIN_MAX_CODES], g_numbers[GCODEBIN_MAX_CODES];
+  uint8_t m_count = 0, g_count = 0;
+
+  memset(r, 0, sizeof(Record));
+  while (*p)
+  {
+    char letter = *(p++);
+    if (letter < 'A' || letter > 'Z')
+      continue;
+    char* end;
+    double value = strtod(p, &end);
+    p = end;
+
+    if (letter == 'G' || letter == 'M') {
+      int32_t number = to_fixed(value, 0, line);
+      if (number < 0 || number > 0xFFFF)
+        fail(line, "invalid G/M code");
+      if (m_count + g_count == GCODEBIN_MAX_CODES)
+        fail(line, "too many G/M codes");
+      if (letter == 'M') {
+        m_letters[m_count] = letter;
+        m_numbers[m_count++] = number;
+      } else {
+        g_letters[g_count] = letter;
+        g_numbers[g_count++] = number;
+      }
+      continue;
+    }
+
+    const char* word = strchr(GCODEBIN_WORD_LETTERS, letter);
+    if (word == NULL)
+      continue;
+    uint16_t bit = 1 << (word - GCODEBIN_WORD_LETTERS);
+    if (r->words & bit)
+      continue;
+    r->words |= bit;
+    r->values[word - GCODEBIN_WORD_LETTERS] =
+        to_fixed(value, !(bit & GCODEBIN_WORD_INTEGER), line);
+  }
+
+  // The firmware applies M codes before G codes
+  memcpy(r->code_letters, m_letters, m_count);
+  memcpy(r->code_numbers, m_numbers, m_count * sizeof(uint16_t));
+  memcpy(r->code_letters + m_count, g_letters, g_count);
+  memcpy(r->code_numbers + m_count, g_numbers, g_count * sizeof(uint16_t));
+  r->codes = m_count + g_count;
+}
+
+static int has_code(const Record* r, char letter, uint16_t number)
+{
+  for (uint8_t i = 0; i < r->codes; i++)
+    if (r->code_letters[i] == letter && r->code_numbers[i] == number)
+      return 1;
+  return 0;
+}
+
+static int64_t word_value(const Record* r, uint16_t word)
+{
+  return r->values[__builtin_ctz(word)];
+}
+
+/*
+ * Follows Z and E through the record, adding a layer entry at the first
+ * extruding move above the previous layer.
+ */
+static void track_layers(const Record* r, uint32_t line_before)
+{
+  const uint16_t z_word = 1 << (strchr(GCODEBIN_WORD_LETTERS, 'Z') - GCODEBIN_WORD_LETTERS);
+  Tracker* t = &tracker;
+  uint32_t modes = t->modes;
+  int32_t feedrate = t->feedrate;
+
+  if (has_code(r, 'G', 90)) t->modes &= ~GCODEBIN_MODE_RELATIVE;
+  if (has_code(r, 'G', 91)) t->modes |= GCODEBIN_MODE_RELATIVE;
+  if (has_code(r, 'M', 82)) t->modes &= ~GCODEBIN_MODE_RELATIVE_E;
+  if (has_code(r, 'M', 83)) t->modes |= GCODEBIN_MODE_RELATIVE_E;
+  if (has_code(r, 'G', 21)) t->modes &= ~GCODEBIN_MODE_INCHES;
+  if (has_code(r, 'G', 20)) t->modes |= GCODEBIN_MODE_INCHES;
+  if (r->words & GCODEBIN_WORD_F) t->feedrate = word_value(r, GCODEBIN_WORD_F);
+  int relative = t->modes & GCODEBIN_MODE_RELATIVE;
+  int relative_e = t->modes & GCODEBIN_MODE_RELATIVE_E;
+
+  if (has_code(r, 'G', 92)) {
+    if (r->words & z_word) t->z = word_value(r, z_word);
+    if (r->words & GCODEBIN_WORD_E) t->e = word_value(r, GCODEBIN_WORD_E);
+    return;
+  }
+  if (has_code(r, 'G', 28)) {
+    // Without axis words every axis is homed
+    if ((r->words & z_word) || !(r->words & GCODEBIN_WORD_AXES))
+      t->z = 0;
+    return;
+  }
+  if (has_code(r, 'G', 10))
+    return;
+
+  int64_t e = t->e;
+  if (r->words & z_word) {
+    t->z = relative ? t->z + word_value(r, z_word) : word_value(r, z_word);
+    t->z_offset = offset;
+    t->z_line = line_before;
+    t->z_e = e;
+    t->z_modes = modes;
+    t->z_feedrate = feedrate;
+  }
+  if (!(r->words & GCODEBIN_WORD_E))
+    return;
+  t->e = relative_e ? e + word_value(r, GCODEBIN_WORD_E) : word_value(r, GCODEBIN_WORD_E);
+  if (t->e <= e || (t->has_layer && t->z <= t->layer_z))
+    return;
+
+  t->has_layer = 1;
+  t->layer_z = t->z;
+  layer_entries = realloc(layer_entries, (layer_count + 1) * LAYER_WORDS * sizeof(int32_t));
+  if (layer_entries == NULL)
+    fail(0, "out of memory");
+  int32_t* entry = layer_entries + layer_count * LAYER_WORDS;
+  entry[0] = t->z_offset;
+  entry[1] = t->z_line;
+  entry[2] = (int32_t) t->z;
+  entry[3] = (t->z_modes & GCODEBIN_MODE_RELATIVE_E) ||
+      t->z_e < INT32_MIN + 1 || t->z_e > INT32_MAX ? GCODEBIN_NO_E : (int32_t) t->z_e;
+  entry[4] = t->z_modes;
+  entry[5] = t->z_feedrate;
+  layer_count++;
+}
+
+static void write_record(const Record* r, uint16_t lines, uint32_t source_line)
+{
+  uint8_t buf[GCODEBIN_RECORD_MAX_SIZE];
+  uint8_t* p = buf;
+
+  if (record_count % GCODEBIN_INDEX_INTERVAL == 0)
+  {
+    index_entries = realloc(index_entries, (index_count + 1) * 2 * sizeof(uint32_t));
+    if (index_entries == NULL)
+      fail(0, "out of memory");
+    index_entries[index_count * 2] = offset;
+    index_entries[index_count * 2 + 1] = source_line;
+    index_count++;
+  }
+  record_count++;
+  track_layers(r, source_line - lines);
+
+  p = put_u16(p, r->words);
+  p = put_u16(p, lines);
+  *(p++) = r->codes;
+  for (uint8_t i = 0; i < r->codes; i++)
+  {
+    *(p++) = r->code_letters[i];
+    p = put_u16(p, r->code_numbers[i]);
+  }
+  for (uint8_t i = 0; i < GCODEBIN_WORD_COUNT; i++)
+  {
+    if (r->words & (1 << i))
+      p = put_u32(p, (uint32_t) r->values[i]);
+  }
+  put(buf, p - buf);
+}
+
+static void write_header(uint32_t records_end, uint32_t line_count)
+{
+  uint8_t buf[GCODEBIN_HEADER_SIZE];
+  uint8_t* p = buf;
+  memcpy(p, GCODEBIN_MAGIC, 4);
+  p = put_u16(p + 4, GCODEBIN_VERSION);
+  p = put_u16(p, 0);
+  p = put_u32(p, record_count);
+  p = put_u32(p, records_end);
+  p = put_u32(p, index_count);
+  p = put_u32(p, line_count);
+  p = put_u32(p, layer_count);
+  put(buf, p - buf);
+}
+
+/*
+ * Reads the file back the way the firmware does and checks that printing
+ * from every layer counts the same lines as printing from the top.
+ */
+static void check_layers(const char* path, uint32_t size)
+{
+  FILE* f = fopen(path, "rb");
+  if (f == NULL)
+    fail(0, "cannot open output");
+  uint8_t* buf = malloc(size);
+  if (buf == NULL)
+    fail(0, "out of memory");
+  if (fread(buf, 1, size, f) != size)
+    fail(0, "read back failed");
+  fclose(f);
+
+  uint32_t records_end = GCODEBIN_U32(buf + 12);
+  const uint8_t* layers = buf + records_end + 8 * GCODEBIN_U32(buf + 16);
+  uint32_t count = GCODEBIN_U32(buf + 24);
+  uint32_t line = 1;
+  uint32_t layer = 0;
+  for (uint32_t pos = GCODEBIN_HEADER_SIZE; pos < records_end;
+       pos += GCODEBIN_RECORD_SIZE(buf + pos))
+  {
+    // Both add the line count of the layer's first record to their start
+    for (; layer < count && GCODEBIN_U32(layers + layer * GCODEBIN_LAYER_SIZE) == pos; layer++)
+    {
+      if (GCODEBIN_U32(layers + layer * GCODEBIN_LAYER_SIZE + 4) != line)
+        fail(line + GCODEBIN_U16(buf + pos + 2), "layer starts at a different line");
+    }
+    line += GCODEBIN_U16(buf + pos + 2);
+  }
+  if (layer != count)
+    fail(0, "layer does not start at a record");
+  free(buf);
+}
+
+int main(int argc, char* argv[])
+{
+  if (argc != 3) {
+    fprintf(stderr, "Usage: gcode2radb <input.gcode> <output>\n");
+    return 2;
+  }
+
+  FILE* in = fopen(argv[1], "rb");
+  if (in == NULL)
+    fail(0, "cannot open input");
+  out = fopen(argv[2], "wb");
+  if (out == NULL)
+    fail(0, "cannot open output");
+
+  // Filled in once the counts are known
+  write_header(0, 0);
+  tracker.z_offset = offset;
+  tracker.z_line = 1;
+
+  char line[LINE_LENGTH * 4];
+  unsigned long line_number = 0;
+  uint32_t last_line = 1;
+  long source_size = 0;
+  while (fgets(line, sizeof(line), in))
+  {
+    size_t len = strlen(line);
+    source_size += len;
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n')
+      fail(line_number + 1, "line too long");
+    line_number++;
+
+    filter_line(line);
+    if (strlen(line) >= LINE_LENGTH)
+      fail(line_number, "line too long");
+
+    Record r;
+    parse_line(line, &r, line_number);
+    if (r.words == 0 && r.codes == 0)
+      continue;
+
+    // Empty records carry the line count over long comment blocks
+    uint32_t lines = line_number - last_line;
+    while (lines > 0xFFFF)
+    {
+      Record empty;
+      memset(&empty, 0, sizeof(empty));
+      last_line += 0xFFFF;
+      write_record(&empty, 0xFFFF, last_line);
+      lines -= 0xFFFF;
+    }
+    write_record(&r, lines, line_number);
+    last_line = line_number;
+  }
+  if (ferror(in))
+    fail(0, "read failed");
+  fclose(in);
+
+  uint32_t records_end = offset;
+  for (uint32_t i = 0; i < index_count * 2; i++)
+  {
+    uint8_t buf[4];
+    put_u32(buf, index_entries[i]);
+    put(buf, 4);
+  }
+  for (uint32_t i = 0; i < layer_count * LAYER_WORDS; i++)
+  {
+    uint8_t buf[4];
+    put_u32(buf, (uint32_t) layer_entries[i]);
+    put(buf, 4);
+  }
+  uint32_t size = offset;
+
+  if (fseek(out, 0, SEEK_SET) != 0)
+    fail(0, "seek failed");
+  write_header(records_end, line_number);
+  if (fclose(out) != 0)
+    fail(0, "write failed");
+  check_layers(argv[2], size);
+
+  printf("%lu lines, %lu records, %lu layers, %ld -> %lu bytes\n", line_number,
+      (unsigned long) record_count, (unsigned long) layer_count, source_size,
+      (unsigned long) size);
+  return 0;
+}
@@ -0,0 +1,66 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Stand-in for the kernel, as much as the planner and the G-code decoder
+ * use. There is only one thread, chSemWait() is in gcodetime.c and runs
+ * the queue like the stepper would when the planner has to wait.
+ */
+
+#ifndef _CH_H_
+#define _CH_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* RADS and RADS2 tick rate */
+#ifndef CH_FREQUENCY
+#define CH_FREQUENCY 10000
+#endif
+
+typedef uint32_t systime_t;
+typedef int32_t msg_t;
+typedef int32_t cnt_t;
+typedef int bool_t;
+
+#define TRUE 1
+#define FALSE 0
+
+#define S2ST(sec) ((systime_t) ((sec) * CH_FREQUENCY))
+#define MS2ST(msec) \
+  ((systime_t) (((((uint32_t) (msec)) * ((uint32_t) CH_FREQUENCY) - 1UL) / 1000UL) + 1UL))
+
+typedef struct {
+  cnt_t s_cnt;
+} Semaphore;
+
+/* Only referenced by PrinterCommand */
+typedef struct Mailbox Mailbox;
+typedef struct EventSource EventSource;
+
+#define chSysLock()
+#define chSysUnlock()
+
+#define chSemInit(sp, n) ((sp)->s_cnt = (n))
+#define chSemSignalI(sp) ((sp)->s_cnt++)
+#define chSemResetI(sp, n) ((sp)->s_cnt = (n))
+void chSemWait(Semaphore* sp);
+
+#endif
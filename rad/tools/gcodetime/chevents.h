@@ -0,0 +1,5 @@
+/*
+ * Stand-in for the kernel events, see ch.h.
+ */
+
+#include "ch.h"
@@ -0,0 +1,506 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * gcodetime - Estimates the print time of a G-code file
+ *
+ * Usage: gcodetime [-l <joint>=<speed>,<acceleration>...] <input.gcode> [output.gcode]
+ *
+ * Lines are decoded by gcode.c and the moves planned by planner.c and
+ * planner_queue.c, against machines/generic/machine.c, built for the
+ * host. The tool stands in for the printer thread and the stepper: a
+ * block is run when the planner waits for room in the queue, so the
+ * queue always has its full look-ahead, and the commands that wait for
+ * motion to finish drain it as they do in printer.c. Nothing is stepped.
+ * Heating and homing take no time, their count is reported instead.
+ *
+ * Prints the time of every layer. A layer starts at the line that last
+ * moved Z before the first extruding move above the previous layer, the
+ * record gcode2radb starts the layer at. With an output file,
+ * the input is copied with M73 P<percent> R<minutes left> before every
+ * layer, which the firmware counts down on the dashboard and reports
+ * with M27. M73 lines already in the input are dropped.
+ *
+ * The limits of a joint, X, Y or Z, or of the extruders, E, which also
+ * take the retract speed and acceleration, can be changed for the run,
+ * e.g. -l Z=10,50 -l E=50,1000,50,1000.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "gcodetime.h"
+
+/* Same limit as the storage reader, including the terminator */
+#define LINE_LENGTH 128
+
+/*===========================================================================*/
+/* Printer thread.                                                           */
+/*===========================================================================*/
+
+static PrinterCommand* curr_command;
+static PrinterMode mode;
+
+static void printerSyncCommanded(void);
+
+#include "command/move.h"
+
+/* Time spent on each line, blocks are charged to the line that added them */
+static double* line_times;
+static unsigned long line_count;
+static unsigned long line_number;
+static unsigned long block_lines[BLOCK_BUFFER_SIZE];
+
+/* Layers as gcode2radb finds them, layer 0 is what comes before */
+static bool_t has_layer;
+static float layer_z;
+static unsigned long z_line = 1;
+static uint32_t layer_count;
+static unsigned long* layer_lines;
+
+static unsigned long waits;
+static unsigned long homings;
+
+static void fail(unsigned long line, const char* message)
+{
+  if (line)
+    fprintf(stderr, "gcodetime: line %lu: %s\n", line, message);
+  else
+    fprintf(stderr, "gcodetime: %s\n", message);
+  exit(1);
+}
+
+/*===========================================================================*/
+/* Stepper.                                                                  */
+/*===========================================================================*/
+
+static PlannerPhysicalPosition stepper_position;
+
+RadJointsState stepperGetJointsState(void)
+{
+  RadJointsState state;
+  memset(&state, 0, sizeof(state));
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++)
+    state.joints[i].pos = stepper_position.joints[i];
+  return state;
+}
+
+PlannerVirtualPosition stepperGetCurrentPosition(void)
+{
+  PlannerVirtualPosition pos;
+  machine.kinematics.forward_kinematics(&stepper_position, &pos);
+  return pos;
+}
+
+/* The machine has no temperature inputs here */
+float thermistorConvert(const ThermistorTable* table,
+    const adcsample_t sample, const uint8_t resolution)
+{
+  (void) table;
+  (void) sample;
+  (void) resolution;
+  return 0;
+}
+
+/*
+ * Time to run a block from the exit speed of the one before, speeding
+ * up and braking where calculateTrapezoid() put it.
+ */
+static double block_time(const PlannerOutputBlockSectionP* p, double entry)
+{
+  double a = p->acc;
+  if (a == 0)
+    return p->distance / p->nominal_speed;
+
+  double peak = sqrt(entry * entry + 2 * a * p->decelerate_after);
+  if (peak > p->nominal_speed) peak = p->nominal_speed;
+  if (peak < entry) peak = entry;
+  double accel_distance = (peak * peak - entry * entry) / 2 / a;
+  double t = (peak - entry) / a;
+  // A block that starts at rest and brakes at once has no cruise
+  if (peak > 0)
+    t += (p->decelerate_after - accel_distance) / peak;
+  if (peak > p->exit_speed)
+    t += (peak - p->exit_speed) / a;
+  return t;
+}
+
+/*
+ * Runs the next block of the queue, like the stepper when it is idle.
+ * Returns FALSE when the queue is empty.
+ */
+static bool_t run_block(void)
+{
+  float entry = queueMain.last_exit_speed;
+  unsigned long line = block_lines[queueMain.q_rdptr - queueMain.q_buffer];
+  PlannerOutputBlock block;
+  if (!plannerMainQueueFetchBlockI(&block, BLOCK_Idle))
+    return FALSE;
+
+  if (block.mode == BLOCK_Positional)
+  {
+    line_times[line] += block_time(&block.p, entry);
+    stepper_position = block.p.target;
+  } else if (block.mode == BLOCK_Reset)
+  {
+    stepper_position = block.p.target;
+  }
+  return TRUE;
+}
+
+/*
+ * The planner reserves every block through here. A full queue runs
+ * blocks until there is room, the block reserved is charged to the
+ * current line.
+ */
+void chSemWait(Semaphore* sp)
+{
+  while (sp->s_cnt <= 0)
+  {
+    if (!run_block())
+      fail(line_number, "planner queue stuck");
+  }
+  sp->s_cnt--;
+  block_lines[queueMain.q_wrptr - queueMain.q_buffer] = line_number;
+}
+
+/* printer_wait_motion() */
+static void wait_motion(void)
+{
+  while (run_block())
+    ;
+}
+
+/*===========================================================================*/
+/* Dispatch.                                                                 */
+/*===========================================================================*/
+
+static float clamp_multiplier(float value)
+{
+  return value < 0.1 ? 0.1 : value > 5 ? 5 : value;
+}
+
+/*
+ * G28 without the endstops, the homed joints end up where commandHoming()
+ * sets them and the rest stays.
+ */
+static void run_homing(void)
+{
+  uint32_t mask = 0;
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++) {
+    for (uint8_t j = 0; j < RAD_NUMBER_AXES; j++) {
+      if (!isnan(curr_command->axes_value[j]) &&
+          machine.kinematics.axes[j].name ==
+          machine.kinematics.joints[i].home_axis_name) {
+        mask |= 1 << i;
+        break;
+      }
+    }
+  }
+  if (mask == 0)
+    mask = 0xFFFF;
+
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++) {
+    RadJoint* j = &machine.kinematics.joints[i];
+    if (j->home_search_vel == 0 || j->home_latch_vel == 0)
+      continue;
+    if (j->home_sequence == -1 || (mask & (1 << i)))
+      stepper_position.joints[i] = j->home_search_vel < 0 ? j->min_limit : j->max_limit;
+  }
+  homings++;
+  printerSyncCommanded();
+}
+
+/*
+ * Runs one command the way printer_dispatch() does.
+ */
+static void dispatch(void)
+{
+  if (curr_command->t_value >= 0) {
+    wait_motion();
+    mode.tool = curr_command->t_value;
+  }
+
+  if (curr_command->printer.distance)
+    mode.distance = curr_command->printer.distance;
+  if (curr_command->printer.extruder_distance)
+    mode.extruder_distance = curr_command->printer.extruder_distance;
+  if (curr_command->printer.feedrate > 0)
+    mode.feedrate = curr_command->printer.feedrate;
+  if (curr_command->printer.unit)
+    mode.unit = curr_command->printer.unit;
+
+  switch (curr_command->code)
+  {
+  case GCODE_M104:
+  case GCODE_M140:
+    wait_motion();
+    break;
+  default:
+    break;
+  }
+
+  if (curr_command->wait)
+  {
+    wait_motion();
+    waits++;
+  }
+
+  switch (curr_command->code)
+  {
+  case GCODE_G4:
+    wait_motion();
+    line_times[line_number] += curr_command->p_value / 1000.0;
+    break;
+  case GCODE_G28:
+    wait_motion();
+    run_homing();
+    break;
+  case GCODE_G92:
+    commandSetPosition();
+    break;
+  case GCODE_M303:
+    wait_motion();
+    break;
+  case GCODE_M220:
+    feedrate_multiplier = clamp_multiplier(curr_command->s_value / 100.0f);
+    break;
+  case GCODE_M221:
+    flow_multiplier = clamp_multiplier(curr_command->s_value / 100.0f);
+    break;
+  default:
+    break;
+  }
+
+  if (!(curr_command->type & COMMANDTYPE_CanHaveAxisWords) ||
+      (curr_command->type & COMMANDTYPE_Movement) == COMMANDTYPE_Movement)
+  {
+    uint8_t z = 0;
+    while (z < RAD_NUMBER_AXES && machine.kinematics.axes[z].name != AXIS_Z)
+      z++;
+    float e = commanded.extruders[mode.tool];
+    if (z < RAD_NUMBER_AXES && !isnan(curr_command->axes_value[z]))
+      z_line = line_number;
+
+    commandMove();
+
+    // The first extruding move above the previous layer starts a layer
+    if (commanded.extruders[mode.tool] > e &&
+        (!has_layer || (z < RAD_NUMBER_AXES && commanded.axes[z] > layer_z)))
+    {
+      has_layer = TRUE;
+      layer_z = z < RAD_NUMBER_AXES ? commanded.axes[z] : 0;
+      layer_lines = realloc(layer_lines, (layer_count + 2) * sizeof(unsigned long));
+      if (layer_lines == NULL)
+        fail(0, "out of memory");
+      layer_lines[++layer_count] = z_line;
+    }
+  }
+
+  if (curr_command->power)
+    wait_motion();
+}
+
+/*===========================================================================*/
+/* Files.                                                                    */
+/*===========================================================================*/
+
+/*
+ * Decodes a line as the storage reader would. Returns FALSE for lines
+ * the printer thread would not see. Invalid lines are reported when warn
+ * is set, the first pass over the file does it.
+ */
+static bool_t decode_line(const char* line, PrinterCommand* cmd, bool_t warn)
+{
+  char buf[LINE_LENGTH];
+  parse_context_t parse_context;
+  decode_context_t decode_context;
+
+  size_t len = strlen(line);
+  while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+    len--;
+  gcodeResetParseContext(&parse_context);
+  int n = gcodeFilterBlock(buf, sizeof(buf) - 1, line, len, &parse_context);
+  if (n < 0)
+    fail(line_number, "line too long");
+  buf[n] = 0;
+
+  if (!gcodeDecode(cmd, buf, &decode_context))
+  {
+    if (warn)
+      fprintf(stderr, "gcodetime: line %lu: invalid command, skipped\n", line_number);
+    return FALSE;
+  }
+  return (cmd->type & COMMANDTYPE_Action) != 0;
+}
+
+static bool_t is_progress_line(const char* line)
+{
+  PrinterCommand cmd;
+  return decode_line(line, &cmd, FALSE) && cmd.code == GCODE_M73;
+}
+
+static void write_progress(FILE* out, double done, double total)
+{
+  double left = total - done;
+  fprintf(out, "M73 P%d R%.1f\n",
+      total > 0 ? (int) (100 * done / total) : 100,
+      left > 0 ? left / 60 : 0);
+}
+
+static void parse_limit(const char* arg)
+{
+  char letter = arg[0];
+  float v[4];
+  int n;
+  if (arg[1] != '=' ||
+      (n = sscanf(arg + 2, "%f,%f,%f,%f", &v[0], &v[1], &v[2], &v[3])) < 2)
+    fail(0, "limits are given as <joint>=<speed>,<acceleration>");
+  for (int i = 0; i < n; i++)
+    if (v[i] <= 0)
+      fail(0, "limits must be positive");
+
+  if (letter == 'E') {
+    for (uint8_t i = 0; i < RAD_NUMBER_EXTRUDERS; i++) {
+      RadExtruder* ex = &machine.extruder.devices[i];
+      ex->max_speed = v[0];
+      ex->max_acceleration = v[1];
+      ex->max_retract_speed = n >= 4 ? v[2] : v[0];
+      ex->max_retract_acceleration = n >= 4 ? v[3] : v[1];
+    }
+    return;
+  }
+  for (uint8_t i = 0; i < RAD_NUMBER_JOINTS; i++) {
+    RadJoint* j = &machine.kinematics.joints[i];
+    if (j->home_axis_name == letter) {
+      j->max_speed = v[0];
+      j->max_acceleration = v[1];
+      return;
+    }
+  }
+  fail(0, "unknown joint");
+}
+
+int main(int argc, char* argv[])
+{
+  int arg = 1;
+  for (; arg < argc && strcmp(argv[arg], "-l") == 0 && arg + 1 < argc; arg += 2)
+    parse_limit(argv[arg + 1]);
+  if (argc - arg < 1 || argc - arg > 2) {
+    fprintf(stderr,
+        "Usage: gcodetime [-l <joint>=<speed>,<acceleration>...] <input.gcode> [output.gcode]\n");
+    return 2;
+  }
+
+  FILE* in = fopen(argv[arg], "rb");
+  if (in == NULL)
+    fail(0, "cannot open input");
+
+  // As threadPrinter() starts
+  plannerInit();
+  mode.rapid = RAPIDMODE_Feed;
+  mode.distance = DISTANCEMODE_Absolute;
+  mode.unit = UNITMODE_Millimeter;
+  mode.extruder_distance = DISTANCEMODE_Absolute;
+  mode.tool = 0;
+  mode.feedrate = 30;
+
+  layer_lines = calloc(1, sizeof(unsigned long));
+  if (layer_lines == NULL)
+    fail(0, "out of memory");
+
+  PrinterCommand cmd;
+  curr_command = &cmd;
+  char line[LINE_LENGTH * 4];
+  while (fgets(line, sizeof(line), in))
+  {
+    size_t len = strlen(line);
+    if (len == sizeof(line) - 1 && line[len - 1] != '\n')
+      fail(line_number + 1, "line too long");
+    if (++line_number >= line_count)
+    {
+      line_count = line_count ? line_count * 2 : 4096;
+      line_times = realloc(line_times, line_count * sizeof(double));
+      if (line_times == NULL)
+        fail(0, "out of memory");
+    }
+    line_times[line_number] = 0;
+    if (decode_line(line, &cmd, TRUE) && cmd.code != GCODE_M73)
+      dispatch();
+  }
+  if (ferror(in))
+    fail(0, "read failed");
+  wait_motion();
+
+  // Layer i runs from its line up to the line of the next one
+  double* layer_times = calloc(layer_count + 1, sizeof(double));
+  if (layer_times == NULL)
+    fail(0, "out of memory");
+  double total = 0;
+  uint32_t layer = 0;
+  for (unsigned long i = 1; i <= line_number; i++)
+  {
+    while (layer < layer_count && layer_lines[layer + 1] <= i)
+      layer++;
+    layer_times[layer] += line_times[i];
+    total += line_times[i];
+  }
+
+  double done = layer_times[0];
+  printf("Layer      Line     Time    Start\n");
+  for (uint32_t i = 1; i <= layer_count; i++)
+  {
+    printf("%5lu %9lu %7.1fs %5lu:%02lu\n", (unsigned long) i, layer_lines[i],
+        layer_times[i], (unsigned long) (done / 3600), (unsigned long) done / 60 % 60);
+    done += layer_times[i];
+  }
+  printf("Total %lu:%02lu:%02lu, %lu layers. Not included: %lu heating waits, %lu homings\n",
+      (unsigned long) (total / 3600), (unsigned long) total / 60 % 60,
+      (unsigned long) total % 60, (unsigned long) layer_count, waits, homings);
+
+  if (argc - arg == 1)
+    return 0;
+
+  FILE* out = fopen(argv[arg + 1], "wb");
+  if (out == NULL)
+    fail(0, "cannot open output");
+  rewind(in);
+
+  layer = 0;
+  done = 0;
+  line_number = 0;
+  write_progress(out, 0, total);
+  while (fgets(line, sizeof(line), in))
+  {
+    line_number++;
+    if (layer < layer_count && layer_lines[layer + 1] == line_number) {
+      done += layer_times[layer];
+      layer++;
+      write_progress(out, done, total);
+    }
+    if (!is_progress_line(line))
+      fputs(line, out);
+  }
+  fprintf(out, "M73 P100 R0\n");
+  if (ferror(in) || fclose(out) != 0)
+    fail(0, "write failed");
+  fclose(in);
+  return 0;
+}
@@ -0,0 +1,56 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Takes the place of rad.h for the firmware sources gcodetime builds,
+ * the Makefile includes it ahead of each of them. Only the headers of
+ * the machine, the planner and the G-code decoder are pulled in.
+ */
+
+#ifndef _GCODETIME_H_
+#define _GCODETIME_H_
+
+#define _RAD_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+
+#include "ch.h"
+#include "hal.h"
+
+/* RADS, as far as machines/generic/machine.c looks at the board */
+#define RADBOARD_ENDSTOP_X            0
+#define RADBOARD_ENDSTOP_Y            1
+#define RADBOARD_ENDSTOP_Z            2
+#define RADBOARD_EXTRUDER_1_STEPPER   3
+#define RADBOARD_EXTRUDER_2_STEPPER   4
+#define TEMP_R2 560
+
+#define RAD_DEBUG_PRINTF(...)
+
+#include "temperature.h"
+#include "radhal_machine.h"
+#include "gcode_definition.h"
+#include "gcode.h"
+#include "stepper.h"
+
+#endif
@@ -0,0 +1,12 @@
+/*
+ * Stand-in for the HAL, only the types the machine definition needs.
+ */
+
+#ifndef _HAL_H_
+#define _HAL_H_
+
+#include "ch.h"
+
+typedef uint16_t adcsample_t;
+
+#endif
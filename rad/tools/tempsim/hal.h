@@ -0,0 +1,3 @@
+/*
+ * Stand-in for the HAL, the simulation has no ADC.
+ */
@@ -0,0 +1,339 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * tempsim - Runs a heater in simulated time
+ *
+ * Usage: tempsim [-b] [-k <Kp>,<Ki>,<Kd>] [-f <Kf_flow>,<Kf_fan>] [-c <ms>]
+ *                [-s <degC>] [-t <s>] [-e <mm/s>,<s>] [-F <fan>,<s>]
+ *                [-a <cycles>] [-p <plant>] [-o <trace.csv>] [-v]
+ *
+ * The PID and autotune of temperature_pid.h run as they are, fed with a
+ * reading every TEMPERATURE_SAMPLE_INTERVAL from the plant model of
+ * temperature_plant.h, as fast as the host can go.
+ *
+ * A step from ambient to the target is reported with the time to reach
+ * the target, the overshoot, the time to settle within SETTLE_BAND and
+ * the mean error over the last quarter of the run. Extrusion or the fan
+ * can be started part way, once settled, to see how far the temperature
+ * dips and how long it takes to come back. With -a the heater is
+ * autotuned at the target instead, and the gains found are printed.
+ *
+ *   -b   the bed, hotend otherwise. Sets the plant, gains and control
+ *        interval of machines/generic/machine.c.
+ *   -k   PID gains, Ki per second and Kd in seconds
+ *   -f   feed-forward gains, see RadTempConfig
+ *   -c   control interval, 0 for every sample
+ *   -s   target, 200 or 60 degC for the bed
+ *   -t   length of the run, 600 seconds by default
+ *   -e   extrudes mm/s of filament from the given second on
+ *   -F   runs the fan at 0-255 from the given second on
+ *   -p   plant as <W>,<J/K>,<W/K>,<sensor tau s>,<dead time s>,
+ *        <ambient degC>,<noise degC>,<J/K per mm>,<W/K at full fan>,
+ *        see RadTempPlantConfig
+ *   -o   writes time, reading, target, duty, flow and fan of every sample
+ *   -v   prints the debug output of the autotune
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <math.h>
+
+#include "ch.h"
+/* Keeps the firmware rad.h out, this file stands in for it */
+#define _RAD_H_
+#include "temperature.h"
+#include "localization/neutral.h"
+
+#define SETTLE_BAND 1.0f
+
+/*===========================================================================*/
+/* Firmware stand-ins.                                                       */
+/*===========================================================================*/
+
+#define RAD_NUMBER_EXTRUDERS 1
+
+typedef struct {
+  int8_t      heating_pwm_id;
+  int8_t      cooling_pwm_id;
+  systime_t   control_interval;
+} RadTemp;
+
+typedef struct {
+  uint8_t     temp_id;
+} RadExtruder;
+
+static RadTemp heater = { .heating_pwm_id = 0, .cooling_pwm_id = 1 };
+static RadExtruder extruder = { .temp_id = 0 };
+static struct {
+  struct {
+    RadTemp* devices;
+  } temperature;
+  struct {
+    RadExtruder* devices;
+  } extruder;
+} machine = { { &heater }, { &extruder } };
+
+systime_t sim_time;
+static uint8_t duty;
+static uint8_t fan;
+static float flow;
+static const char* estop_message;
+static int verbose;
+
+static void outputSet(int8_t output_id, uint8_t value)
+{
+  if (output_id == 0)
+    duty = value;
+}
+
+static uint8_t outputGet(int8_t output_id)
+{
+  return output_id == 0 ? duty : fan;
+}
+
+static float stepperGetExtrusionRate(uint8_t extruder_id)
+{
+  (void) extruder_id;
+  return flow;
+}
+
+static bool_t printerIsEstopped(void)
+{
+  return estop_message != NULL;
+}
+
+static void printerEstop(const char* message)
+{
+  estop_message = message;
+  duty = 0;
+}
+
+static void debug_printf(const char* fmt, ...)
+{
+  if (!verbose)
+    return;
+  va_list arg;
+  va_start(arg, fmt);
+  fprintf(stderr, "%7.1fs ", (double) sim_time / CH_FREQUENCY);
+  vfprintf(stderr, fmt, arg);
+  va_end(arg);
+}
+
+#define RAD_DEBUG_PRINTF debug_printf
+
+static RadTempPidState pid_states[1];
+
+#include "temperature_pid.h"
+
+/*===========================================================================*/
+/* Simulation.                                                               */
+/*===========================================================================*/
+
+static void usage(void)
+{
+  fprintf(stderr,
+      "Usage: tempsim [-b] [-k <Kp>,<Ki>,<Kd>] [-f <Kf_flow>,<Kf_fan>] [-c <ms>]\n"
+      "               [-s <degC>] [-t <s>] [-e <mm/s>,<s>] [-F <fan>,<s>] [-a <cycles>]\n"
+      "               [-p <W>,<J/K>,<W/K>,<tau>,<dead>,<ambient>,<noise>,<J/K/mm>,<W/K fan>]\n"
+      "               [-o <trace.csv>] [-v]\n");
+  exit(2);
+}
+
+/* Same setup as temperatureAutoTune() */
+static void start_autotune(float target, uint8_t cycles)
+{
+  RadTempPidState* state = &pid_states[0];
+  RadTempTuneState* tune = &state->tune;
+  memset(tune, 0, sizeof(RadTempTuneState));
+  tune->target = target;
+  tune->pv_low = 10000;
+  tune->bias = tune->d = 255 / 2;
+  tune->t1 = sim_time - S2ST(10);
+  tune->t2 = sim_time;
+  tune->last_report = sim_time;
+  tune->backup = state->config;
+  state->tuning_cycle_remains = cycles;
+}
+
+int main(int argc, char* argv[])
+{
+  RadTempPlantConfig plant_config = TEMP_PLANT_HOTEND;
+  RadTempConfig config = { .Kp = 2.8, .Ki = 11, .Kd = 0.18 };
+  float target = NAN, length = 600;
+  float flow_rate = 0, flow_at = 0, fan_at = 0;
+  int fan_duty = 0;
+  int cycles = 0, custom_plant = 0, interval_ms = -1;
+  const char* trace_name = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char* opt = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+    if (strcmp(opt, "-b") == 0) {
+      if (!custom_plant)
+        plant_config = (RadTempPlantConfig) TEMP_PLANT_BED;
+      if (interval_ms < 0)
+        interval_ms = 500;
+      if (isnan(target))
+        target = 60;
+      continue;
+    }
+    if (strcmp(opt, "-v") == 0) {
+      verbose = 1;
+      continue;
+    }
+    if (value == NULL)
+      usage();
+    i++;
+    if (strcmp(opt, "-k") == 0) {
+      if (sscanf(value, "%f,%f,%f", &config.Kp, &config.Ki, &config.Kd) != 3)
+        usage();
+    } else if (strcmp(opt, "-f") == 0) {
+      if (sscanf(value, "%f,%f", &config.Kf_flow, &config.Kf_fan) != 2)
+        usage();
+    } else if (strcmp(opt, "-e") == 0) {
+      if (sscanf(value, "%f,%f", &flow_rate, &flow_at) != 2)
+        usage();
+    } else if (strcmp(opt, "-F") == 0) {
+      if (sscanf(value, "%d,%f", &fan_duty, &fan_at) != 2 || fan_duty < 0 || fan_duty > 255)
+        usage();
+    } else if (strcmp(opt, "-c") == 0) {
+      interval_ms = atoi(value);
+    } else if (strcmp(opt, "-s") == 0) {
+      target = atof(value);
+    } else if (strcmp(opt, "-t") == 0) {
+      length = atof(value);
+    } else if (strcmp(opt, "-a") == 0) {
+      cycles = atoi(value);
+      if (cycles < 1 || cycles > 255)
+        usage();
+    } else if (strcmp(opt, "-p") == 0) {
+      RadTempPlantConfig* p = &plant_config;
+      if (sscanf(value, "%f,%f,%f,%f,%f,%f,%f,%f,%f", &p->power, &p->capacity, &p->loss,
+                 &p->sensor_tau, &p->dead_time, &p->ambient, &p->noise,
+                 &p->flow_heat, &p->fan_loss) != 9)
+        usage();
+      custom_plant = 1;
+    } else if (strcmp(opt, "-o") == 0) {
+      trace_name = value;
+    } else {
+      usage();
+    }
+  }
+  if (isnan(target))
+    target = 200;
+  heater.control_interval = interval_ms > 0 ? MS2ST(interval_ms) : 0;
+
+  FILE* trace = NULL;
+  if (trace_name && (trace = fopen(trace_name, "w")) == NULL)
+  {
+    fprintf(stderr, "tempsim: cannot open %s\n", trace_name);
+    return 1;
+  }
+  if (trace)
+    fprintf(trace, "time,pv,sv,duty,flow,fan\n");
+
+  static RadTempPlant plant;
+  tempPlantInit(&plant, &plant_config, 1);
+  temperature_pid_configure(&pid_states[0], &config);
+  float pv = plant_config.ambient;
+  float sv = cycles ? 0 : target;
+  if (cycles)
+    start_autotune(target, cycles);
+
+  float reached = -1, overshoot = 0, settled = 0, error_sum = 0;
+  float disturbed = -1, dip = 0, recovered = -1;
+  unsigned long error_count = 0;
+  const float dt = (float) TEMPERATURE_SAMPLE_INTERVAL / CH_FREQUENCY;
+  for (float t = 0; t < length && !estop_message; t += dt)
+  {
+    sim_time += TEMPERATURE_SAMPLE_INTERVAL;
+    flow = flow_rate > 0 && t >= flow_at ? flow_rate : 0;
+    fan = fan_duty > 0 && t >= fan_at ? fan_duty : 0;
+    pv = tempPlantStep(&plant, &plant_config, duty, flow, fan, dt);
+    temperature_pid_loop(0, sv, pv);
+
+    if (trace)
+      fprintf(trace, "%.2f,%.2f,%.1f,%d,%.1f,%d\n", t + dt, pv, cycles ? target : sv,
+          duty, flow, fan);
+    if (cycles)
+    {
+      if (pid_states[0].tuning_cycle_remains == 0)
+        break;
+      continue;
+    }
+    if (reached < 0 && pv >= sv)
+      reached = t + dt;
+    if (reached >= 0 && pv - sv > overshoot)
+      overshoot = pv - sv;
+    if (disturbed < 0 && (flow > 0 || fan > 0))
+      disturbed = t;
+    if (disturbed >= 0)
+    {
+      if (sv - pv > dip)
+        dip = sv - pv;
+      if (fabsf(pv - sv) > SETTLE_BAND)
+        recovered = t + dt - disturbed;
+    }
+    else if (fabsf(pv - sv) > SETTLE_BAND)
+      settled = t + dt;
+    if (t >= length * 3 / 4)
+    {
+      error_sum += fabsf(pv - sv);
+      error_count++;
+    }
+  }
+  if (trace)
+    fclose(trace);
+
+  if (estop_message)
+  {
+    printf("Estopped at %.1fs: %s\n", (double) sim_time / CH_FREQUENCY, estop_message);
+    return 1;
+  }
+  if (cycles)
+  {
+    if (pid_states[0].tuning_cycle_remains)
+    {
+      printf("Autotune not done after %.0fs, %d cycles left\n",
+          length, pid_states[0].tuning_cycle_remains);
+      return 1;
+    }
+    printf("Autotune done at %.1fs: Kp=%.3f Ki=%.3f Kd=%.3f\n",
+        (double) sim_time / CH_FREQUENCY,
+        pid_states[0].config.Kp, pid_states[0].config.Ki, pid_states[0].config.Kd);
+    return 0;
+  }
+
+  if (reached < 0)
+    printf("Target %.1f not reached in %.0fs, at %.1f\n", target, length, pv);
+  else
+    printf("Reached %.1f at %.1fs, overshoot %.2f, settled within %.1f at %.1fs,"
+        " mean error %.2f\n", target, reached, overshoot, SETTLE_BAND, settled,
+        error_count ? error_sum / error_count : 0);
+  if (disturbed >= 0)
+    printf("From %.1fs: dipped %.2f, back within %.1f after %.1fs\n",
+        disturbed, dip, SETTLE_BAND, recovered < 0 ? 0 : recovered);
+  return 0;
+}
@@ -0,0 +1,96 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * thermcheck - Checks the thermistor tables against the Beta formula
+ *
+ * Usage: thermcheck
+ *
+ * Runs every sample through adccType1 of temperature_converter.c, at
+ * the 12 bits of the ADC and at the 14 bits the oversampled readings
+ * are converted with, and compares it with the closed form Beta formula
+ * of the same parameters. Exits with 1 if a sample inside the table is
+ * off by more than TOLERANCE, or converts to 999 before its hot end.
+ */
+
+#include <stdio.h>
+#include <math.h>
+
+#include "thermcheck.h"
+
+/* Largest error allowed inside the table, degC */
+#define TOLERANCE 0.25
+
+/* The ADC, and with the RADADC_EXTRA_BITS of temperature_core_real.h */
+static const uint8_t resolutions[] = { 12, 12 + 2 };
+
+static double formula(adcsample_t sample, uint8_t resolution,
+                      double r2, double r0, double t0, double beta)
+{
+  adcsample_t inv_sample = (1 << resolution) - 1 - sample;
+  return -273.15 +
+    beta / log((double) sample * r2 / inv_sample / (r0 * exp(-beta / (t0 + 273.15))));
+}
+
+/* Returns the number of samples that fail */
+static unsigned check(uint8_t resolution)
+{
+  const adcsample_t limit = 1 << (resolution - 8);
+  double worst = 0;
+  adcsample_t worst_sample = 0;
+  unsigned failed = 0;
+  for (adcsample_t sample = limit + 1; sample < (1 << resolution) - 1 - limit; sample++)
+  {
+    float t = adccType1(sample, resolution);
+    double expected = formula(sample, resolution, TEMP_R2, THERMISTOR_TYPE1);
+    if (t == 999)
+    {
+      // Only past the hot end of the table
+      if (expected < THERMISTOR_TABLE_TEMP(THERMISTOR_TABLE_SIZE - 1) - TOLERANCE)
+      {
+        printf("%d bits, sample %d: 999, expected %.2f\n", resolution, sample, expected);
+        failed++;
+      }
+      continue;
+    }
+    double error = fabs(t - expected);
+    if (error > worst)
+    {
+      worst = error;
+      worst_sample = sample;
+    }
+    if (error > TOLERANCE)
+      failed++;
+  }
+
+  printf("%d bits: max error %.3f C at sample %d (%.2f C), %u failed\n", resolution,
+      worst, worst_sample, formula(worst_sample, resolution, TEMP_R2, THERMISTOR_TYPE1),
+      failed);
+  return failed;
+}
+
+int main(void)
+{
+  unsigned failed = 0;
+  for (size_t i = 0; i < sizeof(resolutions); i++)
+    failed += check(resolutions[i]);
+  printf(failed ? "FAIL: %u samples\n" : "PASS\n", failed);
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,39 @@
+/*
+    RAD - Copyright (C) 2013 Sam Wong
+
+    This file is part of RAD project.
+
+    RAD is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    RAD is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+*/
+
+/*
+ * Takes the place of rad.h for temperature_converter.c, the Makefile
+ * includes it ahead of it.
+ */
+
+#ifndef _THERMCHECK_H_
+#define _THERMCHECK_H_
+
+#define _RAD_H_
+
+#include "ch.h"
+#include "hal.h"
+
+/* RADS and RADS2 */
+#define TEMP_R2 560
+
+#include "temperature_converter.h"
+
+#endif